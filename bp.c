@@ -0,0 +1,383 @@
+#define LOG_PFX BP
+#include "bp.h"
+#include "guest.h"
+#include "pmem.h"
+#include "mon.h"
+
+#define BP_MAX 16
+#define WP_MAX 8
+
+typedef struct {
+  bool in_use;
+  gea_t ea;
+  gra_t gra;
+  uint32_t insn;
+  uint64_t hits;
+} bp_t;
+
+typedef struct {
+  bool in_use;
+  /*
+   * Stores only, else any access.
+   */
+  bool write;
+  gea_t ea;
+  length_t len;
+  uint64_t hits;
+} wp_t;
+
+static bp_t bps[BP_MAX];
+static wp_t wps[WP_MAX];
+
+/*
+ * Stepping over a hit: the breakpoint to put back and the
+ * watched page to protect again once the trace exit comes.
+ */
+static struct {
+  bool armed;
+  bool ss;
+  bp_t *bp;
+  bool page_valid;
+  gea_t page;
+  bool wp_resume;
+  gea_t wp_pc;
+} step;
+
+static void
+bp_flush(gra_t gra)
+{
+  ha_t ha = pmem_ha(gra & ~7);
+
+  __asm__ __volatile__("dcbst 0,%0\n\t"
+                       "sync\n\t"
+                       "icbi 0,%0\n\t"
+                       "isync" :: "r" (ha) : "memory");
+}
+
+static void
+bp_poke(gra_t gra, uint32_t insn)
+{
+  pmem_to(gra, &insn, sizeof(insn), sizeof(insn));
+  bp_flush(gra);
+}
+
+static bp_t *
+bp_find(gra_t gra)
+{
+  unsigned i;
+
+  for (i = 0; i < BP_MAX; i++) {
+    if (bps[i].in_use && bps[i].gra == gra) {
+      return bps + i;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+bp_arm(void)
+{
+  if (!step.armed) {
+    step.ss = guest_set_ss(true);
+    step.armed = true;
+  }
+}
+
+err_t
+bp_add(gea_t ea)
+{
+  err_t err;
+  gra_t gra;
+  unsigned i;
+  bp_t *b = NULL;
+
+  if ((ea & 3) != 0) {
+    return ERR_BAD_ACCESS;
+  }
+
+  err = guest_backmap(ea, &gra);
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  if (!pmem_gra_valid(gra)) {
+    return ERR_BAD_ACCESS;
+  }
+
+  if (bp_find(gra) != NULL) {
+    return ERR_NONE;
+  }
+
+  for (i = 0; i < BP_MAX; i++) {
+    if (!bps[i].in_use) {
+      b = bps + i;
+      break;
+    }
+  }
+
+  if (b == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  if (pmem_from(&b->insn, gra, sizeof(b->insn),
+                sizeof(b->insn)) != sizeof(b->insn)) {
+    return ERR_BAD_ACCESS;
+  }
+
+  b->in_use = true;
+  b->ea = ea;
+  b->gra = gra;
+  b->hits = 0;
+  bp_poke(gra, BP_TRAP);
+  return ERR_NONE;
+}
+
+err_t
+bp_del(gea_t ea)
+{
+  unsigned i;
+  gra_t gra;
+  uint32_t insn;
+  bp_t *b = NULL;
+
+  for (i = 0; i < BP_MAX; i++) {
+    if (bps[i].in_use && bps[i].ea == ea) {
+      b = bps + i;
+      break;
+    }
+  }
+
+  if (b == NULL && guest_backmap(ea, &gra) == ERR_NONE) {
+    b = bp_find(gra);
+  }
+
+  if (b == NULL) {
+    return ERR_NOT_FOUND;
+  }
+
+  /*
+   * Unless the guest has since loaded something else there,
+   * or we're stepping over it and it's already back.
+   */
+  pmem_from(&insn, b->gra, sizeof(insn), sizeof(insn));
+  if (insn == BP_TRAP) {
+    bp_poke(b->gra, b->insn);
+  }
+
+  if (step.bp == b) {
+    step.bp = NULL;
+  }
+
+  b->in_use = false;
+  return ERR_NONE;
+}
+
+/*
+ * Watching for any access on a page wins over watching
+ * for stores.
+ */
+static vm_prot_t
+wp_page_prot(gea_t page)
+{
+  unsigned i;
+  vm_prot_t prot = VM_PROT_ALL;
+
+  for (i = 0; i < WP_MAX; i++) {
+    if (!wps[i].in_use || (wps[i].ea & ~PAGE_MASK) != page) {
+      continue;
+    }
+
+    if (!wps[i].write) {
+      return VM_PROT_NONE;
+    }
+
+    prot = VM_PROT_READ | VM_PROT_EXECUTE;
+  }
+
+  return prot;
+}
+
+err_t
+wp_add(gea_t ea, length_t len, bool write)
+{
+  unsigned i;
+  wp_t *w = NULL;
+
+  if (len == 0 ||
+      (ea & ~PAGE_MASK) != ((ea + len - 1) & ~PAGE_MASK)) {
+    return ERR_OUT_OF_BOUNDS;
+  }
+
+  for (i = 0; i < WP_MAX; i++) {
+    if (!wps[i].in_use) {
+      w = wps + i;
+      break;
+    }
+  }
+
+  if (w == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  w->in_use = true;
+  w->write = write;
+  w->ea = ea;
+  w->len = len;
+  w->hits = 0;
+  guest_protect(ea, wp_page_prot(ea & ~PAGE_MASK));
+  return ERR_NONE;
+}
+
+err_t
+wp_del(gea_t ea)
+{
+  unsigned i;
+
+  for (i = 0; i < WP_MAX; i++) {
+    if (wps[i].in_use && wps[i].ea == ea) {
+      wps[i].in_use = false;
+      guest_protect(ea, wp_page_prot(ea & ~PAGE_MASK));
+      return ERR_NONE;
+    }
+  }
+
+  return ERR_NOT_FOUND;
+}
+
+/*
+ * Called for a program exception, returns ERR_NOT_FOUND
+ * if it isn't one of our traps.
+ */
+err_t
+bp_program(void)
+{
+  gra_t gra;
+  bp_t *b;
+
+  if (guest_backmap(guest->regs->ppcPC, &gra) != ERR_NONE) {
+    return ERR_NOT_FOUND;
+  }
+
+  b = bp_find(gra);
+  if (b == NULL) {
+    return ERR_NOT_FOUND;
+  }
+
+  b->hits++;
+  step.bp = b;
+  LOG("breakpoint %u at 0x%x (ra 0x%x)", (unsigned) (b - bps),
+      guest->regs->ppcPC, gra);
+  return ERR_BREAKPOINT;
+}
+
+/*
+ * Called for every page fault, returns ERR_NOT_FOUND for pages
+ * without watchpoints, ERR_CONTINUE if the page should be mapped
+ * in as usual for a single step, or ERR_BREAKPOINT on a hit.
+ *
+ * The fault only gives the start of the access, so hits are
+ * matched to the doubleword.
+ */
+err_t
+bp_fault(gea_t dar, bool store, bool isi)
+{
+  unsigned i;
+  vm_prot_t prot;
+  gea_t page = dar & ~PAGE_MASK;
+
+  prot = wp_page_prot(page);
+  if (prot == VM_PROT_ALL) {
+    return ERR_NOT_FOUND;
+  }
+
+  if (step.wp_resume && guest->regs->ppcPC == step.wp_pc) {
+    step.wp_resume = false;
+  } else if (!isi) {
+    for (i = 0; i < WP_MAX; i++) {
+      wp_t *w = wps + i;
+
+      if (!w->in_use || (w->write && !store)) {
+        continue;
+      }
+
+      if ((dar & ~7) >= (w->ea & ~7) &&
+          (dar & ~7) <= ((w->ea + w->len - 1) & ~7)) {
+        w->hits++;
+        step.wp_resume = true;
+        step.wp_pc = guest->regs->ppcPC;
+        LOG("watchpoint %u: %s 0x%x from 0x%x", i,
+            store ? "store to" : "load from", dar,
+            guest->regs->ppcPC);
+        return ERR_BREAKPOINT;
+      }
+    }
+  }
+
+  step.page = page;
+  step.page_valid = true;
+  bp_arm();
+  return ERR_CONTINUE;
+}
+
+/*
+ * Called for a trace exception, returns true if it was only
+ * our own step and the monitor needn't know about it.
+ */
+bool
+bp_trace(void)
+{
+  if (!step.armed) {
+    return false;
+  }
+
+  step.armed = false;
+  if (step.bp != NULL) {
+    bp_poke(step.bp->gra, BP_TRAP);
+    step.bp = NULL;
+  }
+
+  if (step.page_valid) {
+    guest_protect(step.page, wp_page_prot(step.page));
+    step.page_valid = false;
+  }
+
+  guest_set_ss(step.ss);
+  return !step.ss;
+}
+
+/*
+ * Called when leaving the monitor, to step over the breakpoint
+ * that was hit.
+ */
+void
+bp_resume(void)
+{
+  if (step.bp == NULL) {
+    return;
+  }
+
+  bp_poke(step.bp->gra, step.bp->insn);
+  bp_arm();
+}
+
+void
+bp_mon_dump(void)
+{
+  unsigned i;
+
+  for (i = 0; i < BP_MAX; i++) {
+    if (bps[i].in_use) {
+      mon_printf("  bp %-2u 0x%08x ra 0x%08x hits %llu\n", i,
+                 bps[i].ea, bps[i].gra, bps[i].hits);
+    }
+  }
+
+  for (i = 0; i < WP_MAX; i++) {
+    if (wps[i].in_use) {
+      mon_printf("  wp %-2u 0x%08x-0x%08x %s hits %llu\n", i,
+                 wps[i].ea, wps[i].ea + wps[i].len - 1,
+                 wps[i].write ? "w " : "rw", wps[i].hits);
+    }
+  }
+}
@@ -0,0 +1,314 @@
+/*
+ * Console output capture into an mmap'ed, size-bounded ring
+ * file, for looking at what the guest printed after the fact
+ * (or when nobody was attached). Appending is a memcpy and
+ * a few stores, the kernel writes the pages back on its own.
+ *
+ * An existing capture file of the same size is appended to,
+ * so one file can span several runs.
+ */
+
+#define LOG_PFX CONLOG
+#include "conlog.h"
+#include "hist.h"
+#include "mon.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+#define LINE_MAX_LEN 256
+
+static conlog_hdr_t *hdr;
+static char *data;
+static length_t map_size;
+static length_t slice;
+static uint64_t wall_base_ns;
+static uint64_t mono_base_ns;
+
+static uint64_t
+conlog_now(void)
+{
+  return wall_base_ns + hist_time_ns() - mono_base_ns;
+}
+
+static void
+conlog_reset(length_t data_size)
+{
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->magic = CONLOG_MAGIC;
+  hdr->version = CONLOG_VERSION;
+  hdr->hdr_size = ALIGN_UP(sizeof(conlog_hdr_t), PAGE_SIZE);
+  hdr->data_size = data_size;
+}
+
+err_t
+conlog_init(const char *path,
+            length_t size)
+{
+  int fd;
+  int ret;
+  struct stat st;
+  struct timeval tv;
+  length_t hdr_size = ALIGN_UP(sizeof(conlog_hdr_t), PAGE_SIZE);
+  length_t data_size = ALIGN_UP(size, PAGE_SIZE);
+
+  BUG_ON(data_size % CONLOG_INDEX != 0, "bad capture size");
+
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    POSIX_ERROR(errno, "could not open console capture '%s'", path);
+    return ERR_POSIX;
+  }
+
+  ret = fstat(fd, &st);
+  ON_POSIX_ERROR("fstat", ret, posix_err);
+
+  map_size = hdr_size + data_size;
+  if (st.st_size != map_size) {
+    ret = ftruncate(fd, map_size);
+    ON_POSIX_ERROR("ftruncate", ret, posix_err);
+  }
+
+  hdr = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+  if (hdr == MAP_FAILED) {
+    hdr = NULL;
+    ret = -1;
+    ON_POSIX_ERROR("mmap", ret, posix_err);
+  }
+  close(fd);
+  fd = -1;
+
+  if (hdr->magic != CONLOG_MAGIC ||
+      hdr->version != CONLOG_VERSION ||
+      hdr->hdr_size != hdr_size ||
+      hdr->data_size != data_size) {
+    conlog_reset(data_size);
+  }
+
+  data = (char *) hdr + hdr_size;
+  slice = data_size / CONLOG_INDEX;
+  gettimeofday(&tv, NULL);
+  wall_base_ns = tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+  mono_base_ns = hist_time_ns();
+
+  LOG("capturing console to '%s' (%u KiB, %llu bytes so far)",
+      path, data_size / 1024, hdr->written);
+  return ERR_NONE;
+
+ posix_err:
+  if (fd >= 0) {
+    close(fd);
+  }
+  return ERR_POSIX;
+}
+
+void
+conlog_add(const char *buf,
+           length_t len)
+{
+  uint64_t w;
+  uint64_t next;
+  length_t size;
+
+  if (hdr == NULL || len == 0) {
+    return;
+  }
+
+  size = hdr->data_size;
+  w = hdr->written;
+  if (len > size) {
+    w += len - size;
+    buf += len - size;
+    len = size;
+  }
+
+  /*
+   * Stamp every slice this write starts.
+   */
+  next = ALIGN_UP(w, (uint64_t) slice);
+  if (next < w + len) {
+    uint64_t now = conlog_now();
+
+    for (; next < w + len; next += slice) {
+      conlog_mark_t *m = hdr->index + (next % size) / slice;
+      m->off = next;
+      m->time_ns = now;
+    }
+  }
+
+  while (len != 0) {
+    length_t pos = w % size;
+    length_t chunk = min(len, size - pos);
+
+    memcpy(data + pos, buf, chunk);
+    w += chunk;
+    buf += chunk;
+    len -= chunk;
+  }
+
+  hdr->written = w;
+}
+
+static uint64_t
+conlog_first(void)
+{
+  if (hdr->written < hdr->data_size) {
+    return 0;
+  }
+
+  return hdr->written - hdr->data_size;
+}
+
+static char
+conlog_at(uint64_t off)
+{
+  return data[off % hdr->data_size];
+}
+
+/*
+ * Time at which the slice holding off was written,
+ * or 0 if that's unknown.
+ */
+static uint64_t
+conlog_time(uint64_t off)
+{
+  conlog_mark_t *m = hdr->index + (off % hdr->data_size) / slice;
+
+  if (m->time_ns == 0 || m->off > off || off - m->off >= slice) {
+    return 0;
+  }
+
+  return m->time_ns;
+}
+
+/*
+ * Copies the line starting at off into line, dropping
+ * CRs, and returns where the next line starts.
+ */
+static uint64_t
+conlog_line(uint64_t off,
+            char *line)
+{
+  length_t len = 0;
+
+  while (off < hdr->written) {
+    char c = conlog_at(off++);
+
+    if (c == '\n') {
+      break;
+    }
+
+    if (c != '\r' && len < LINE_MAX_LEN - 1) {
+      line[len++] = c;
+    }
+  }
+
+  line[len] = '\0';
+  return off;
+}
+
+static void
+conlog_print(uint64_t off,
+             const char *line)
+{
+  char stamp[16] = "--:--:--";
+  uint64_t t = conlog_time(off);
+
+  if (t != 0) {
+    time_t secs = t / 1000000000ULL;
+    struct tm tm;
+
+    localtime_r(&secs, &tm);
+    strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+  }
+
+  mon_printf("%10llu %s %s\n", off, stamp, line);
+}
+
+void
+conlog_tail(count_t lines)
+{
+  uint64_t off;
+  uint64_t first;
+  count_t seen = 0;
+  char line[LINE_MAX_LEN];
+
+  if (hdr == NULL) {
+    mon_printf("no console capture, see -c\n");
+    return;
+  }
+
+  if (lines == 0) {
+    return;
+  }
+
+  first = conlog_first();
+  off = hdr->written;
+  if (off > first && conlog_at(off - 1) == '\n') {
+    off--;
+  }
+
+  while (off > first) {
+    if (conlog_at(off - 1) == '\n' && ++seen == lines) {
+      break;
+    }
+    off--;
+  }
+
+  while (off < hdr->written) {
+    uint64_t start = off;
+
+    off = conlog_line(off, line);
+    conlog_print(start, line);
+  }
+}
+
+count_t
+conlog_find(const char *pattern,
+            count_t max)
+{
+  uint64_t off;
+  count_t found = 0;
+  char line[LINE_MAX_LEN];
+
+  if (hdr == NULL) {
+    mon_printf("no console capture, see -c\n");
+    return 0;
+  }
+
+  off = conlog_first();
+  /*
+   * The oldest line has likely been cut by the wrap.
+   */
+  if (off != 0) {
+    while (off < hdr->written && conlog_at(off++) != '\n');
+  }
+
+  while (off < hdr->written && found < max) {
+    uint64_t start = off;
+
+    off = conlog_line(off, line);
+    if (strstr(line, pattern) != NULL) {
+      conlog_print(start, line);
+      found++;
+    }
+  }
+
+  return found;
+}
+
+void
+conlog_bye(void)
+{
+  if (hdr == NULL) {
+    return;
+  }
+
+  msync(hdr, map_size, MS_ASYNC);
+  munmap(hdr, map_size);
+  hdr = NULL;
+}
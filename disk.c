@@ -29,13 +29,23 @@
 #define LOG_PFX DISK
 #include "disk.h"
 #include "list.h"
+#include "hist.h"
+#include "mon.h"
 
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #define SECTOR_SIZE 512
 
+/*
+ * How much of a freshly found partition on a mapped
+ * disk to ask the pager to start bringing in.
+ */
+#define DISK_WILLNEED_BYTES MB(1)
+
 typedef struct {
    uint8_t  boot_ind;   /* 0x80 - active */
    uint8_t  head;       /* starting head */
@@ -49,11 +59,126 @@ typedef struct {
    uint32_t nr_sects;   /* nr of sectors in partition */
 } dos_part_t;
 
+#define DOS_PART_OFFSET    0x1be
+#define DOS_EXTENDED       0x05
+#define DOS_EXTENDED_LBA   0x0f
+#define DOS_EXTENDED_LINUX 0x85
+#define DOS_GPT_PROTECTIVE 0xee
+
+/*
+ * Fields are little-endian.
+ */
+typedef struct {
+  uint8_t  signature[8];
+  uint32_t revision;
+  uint32_t header_size;
+  uint32_t header_crc;
+  uint32_t reserved;
+  uint64_t current_lba;
+  uint64_t backup_lba;
+  uint64_t first_usable_lba;
+  uint64_t last_usable_lba;
+  uint8_t  disk_guid[16];
+  uint64_t entry_lba;
+  uint32_t entry_count;
+  uint32_t entry_size;
+  uint32_t entry_crc;
+} __attribute__((packed)) gpt_header_t;
+
+typedef struct {
+  uint8_t  type[16];
+  uint8_t  guid[16];
+  uint64_t first_lba;
+  uint64_t last_lba;
+  uint64_t flags;
+  uint16_t name[36];
+} __attribute__((packed)) gpt_entry_t;
+
+#define GPT_MAGIC "EFI PART"
+static const uint8_t gpt_unused_type[16] = { 0 };
+
+/*
+ * Apple Partition Map. Fields are big-endian.
+ */
+typedef struct {
+  uint16_t signature;
+  uint16_t block_size;
+  uint32_t block_count;
+} __attribute__((packed)) apm_ddm_t;
+
+typedef struct {
+  uint16_t signature;
+  uint16_t reserved;
+  uint32_t map_count;
+  uint32_t start_block;
+  uint32_t block_count;
+  char     name[32];
+  char     type[32];
+} __attribute__((packed)) apm_part_t;
+
+#define APM_DDM_MAGIC  0x4552 /* 'ER' */
+#define APM_PART_MAGIC 0x504d /* 'PM' */
+
+/*
+ * Bounds EBR chains and GPT/APM entry counts.
+ */
+#define DISK_MAX_PARTS 128U
+
+/*
+ * After a read, the worker reads this much past it, so a
+ * sequential reader finds the next chunk already in memory.
+ */
+#define DISK_RA_SIZE (64 * 1024)
+
 struct disk_s {
   struct list_head link;
   char *path;
   int fd;
   struct stat st;
+  bool read_only;
+  /*
+   * Read-only disks are mapped. pos is the
+   * disk_seek/disk_in/disk_out offset.
+   */
+  uint8_t *map;
+  offset_t pos;
+  /*
+   * Cached partition table, entry N - 1 is partition N.
+   */
+  bool parts_scanned;
+  err_t parts_err;
+  /*
+   * Bumped on every write, so anything cached from the
+   * disk contents can tell it is stale.
+   */
+  uint64_t gen;
+  unsigned part_count;
+  disk_part_t *parts;
+  /*
+   * Disks that aren't mapped get a worker thread that only
+   * does readahead, requests themselves are done inline by
+   * the VM thread. Everything below is protected by lock.
+   */
+  bool has_worker;
+  pthread_t worker;
+  pthread_mutex_t lock;
+  pthread_cond_t kick;
+  bool stopping;
+  uint8_t *ra_buf;
+  offset_t ra_off;
+  length_t ra_len;
+  offset_t ra_next;
+  /*
+   * Statistics, only touched from the VM thread.
+   * Latencies are in ns, sizes in bytes.
+   */
+  disk_io_stats_t stats;
+  uint64_t ra_hits;
+  uint64_t mapped;
+  uint64_t short_io;
+  hist_t read_lat;
+  hist_t write_lat;
+  hist_t io_size;
 };
 
 LIST_HEAD(disks);
@@ -64,14 +189,200 @@ disk_close(disk_t *disk)
   /* Nothing. */
 }
 
+static void
+disk_map(disk_t *disk)
+{
+  void *map;
+
+  if (disk->st.st_size == 0 ||
+      disk->st.st_size != (length_t) disk->st.st_size) {
+    WARN("not mapping disk '%s', using read()", disk->path);
+    return;
+  }
+
+  map = mmap(NULL, disk->st.st_size, PROT_READ,
+             MAP_SHARED, disk->fd, 0);
+  if (map == MAP_FAILED) {
+    POSIX_ERROR(errno, "could not map disk '%s', using read()",
+                disk->path);
+    return;
+  }
+
+  disk->map = map;
+}
+
+static bool
+disk_ra_wanted(disk_t *disk)
+{
+  if (disk->ra_next == (offset_t) -1) {
+    return false;
+  }
+
+  return disk->ra_next < disk->ra_off ||
+    disk->ra_next >= disk->ra_off + disk->ra_len;
+}
+
+static void *
+disk_worker(void *arg)
+{
+  ssize_t ret;
+  offset_t off;
+  disk_t *disk = arg;
+
+  pthread_mutex_lock(&disk->lock);
+  while (!disk->stopping) {
+    if (!disk_ra_wanted(disk)) {
+      pthread_cond_wait(&disk->kick, &disk->lock);
+      continue;
+    }
+
+    /*
+     * The reader went past the readahead buffer, so refill
+     * it from where the last read ended. ra_len is zero
+     * while it's being filled, so the VM thread won't look
+     * at it.
+     */
+    off = disk->ra_next;
+    disk->ra_len = 0;
+    disk->ra_off = off;
+    pthread_mutex_unlock(&disk->lock);
+    ret = pread(disk->fd, disk->ra_buf, DISK_RA_SIZE, off);
+    pthread_mutex_lock(&disk->lock);
+
+    if (disk->ra_off != off) {
+      /*
+       * Overwritten while reading.
+       */
+      continue;
+    }
+
+    if (ret > 0) {
+      disk->ra_len = ret;
+    } else {
+      /*
+       * EOF or error, nothing to read ahead.
+       */
+      disk->ra_next = (offset_t) -1;
+    }
+  }
+  pthread_mutex_unlock(&disk->lock);
+
+  return NULL;
+}
+
+/*
+ * Readahead hits are copied out, everything else is a
+ * plain pread/pwrite on the calling thread. Handing misses
+ * to the worker would only add two thread switches, as the
+ * guest waits for them anyway.
+ */
+static length_t
+disk_submit(disk_t *disk,
+            bool write,
+            offset_t off,
+            uint8_t *buf,
+            length_t len)
+{
+  ssize_t ret;
+
+  pthread_mutex_lock(&disk->lock);
+  if (!write && off >= disk->ra_off &&
+      off + len <= disk->ra_off + disk->ra_len) {
+    memcpy(buf, disk->ra_buf + (off - disk->ra_off), len);
+    disk->ra_next = off + len;
+    disk->ra_hits++;
+    if (disk_ra_wanted(disk)) {
+      pthread_cond_signal(&disk->kick);
+    }
+    pthread_mutex_unlock(&disk->lock);
+    return len;
+  }
+  pthread_mutex_unlock(&disk->lock);
+
+  if (write) {
+    ret = pwrite(disk->fd, buf, len, off);
+  } else {
+    ret = pread(disk->fd, buf, len, off);
+  }
+
+  if (ret < 0) {
+    ret = 0;
+  }
+
+  pthread_mutex_lock(&disk->lock);
+  if (write) {
+    /*
+     * Don't serve stale readahead data.
+     */
+    if (off < disk->ra_off + DISK_RA_SIZE &&
+        off + len > disk->ra_off) {
+      disk->ra_len = 0;
+      disk->ra_off = disk->ra_next = (offset_t) -1;
+    }
+  } else if (ret == len) {
+    disk->ra_next = off + len;
+    if (disk_ra_wanted(disk)) {
+      pthread_cond_signal(&disk->kick);
+    }
+  }
+  pthread_mutex_unlock(&disk->lock);
+
+  return ret;
+}
+
+static err_t
+disk_start_worker(disk_t *disk)
+{
+  int ret;
+
+  disk->ra_buf = malloc(DISK_RA_SIZE);
+  if (disk->ra_buf == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  disk->ra_off = disk->ra_next = (offset_t) -1;
+  pthread_mutex_init(&disk->lock, NULL);
+  pthread_cond_init(&disk->kick, NULL);
+
+  ret = pthread_create(&disk->worker, NULL, disk_worker, disk);
+  if (ret != 0) {
+    POSIX_ERROR(ret, "could not start worker for disk '%s'", disk->path);
+    free(disk->ra_buf);
+    return ERR_POSIX;
+  }
+
+  disk->has_worker = true;
+  return ERR_NONE;
+}
+
+static void
+disk_stop_worker(disk_t *disk)
+{
+  if (!disk->has_worker) {
+    return;
+  }
+
+  pthread_mutex_lock(&disk->lock);
+  disk->stopping = true;
+  pthread_cond_signal(&disk->kick);
+  pthread_mutex_unlock(&disk->lock);
+  pthread_join(disk->worker, NULL);
+  free(disk->ra_buf);
+  disk->has_worker = false;
+}
+
 disk_t *
-disk_open(const char *disk_path)
+disk_open(const char *disk_path,
+          bool read_only)
 {
   int ret;
   disk_t *disk;
 
   list_for_each_entry(disk, &disks, link) {
     if (!strcmp(disk_path, disk->path)) {
+      if (disk->read_only && !read_only) {
+        WARN("disk '%s' already opened read-only", disk_path);
+      }
       return disk;
     }
   }
@@ -89,21 +400,41 @@ disk_open(const char *disk_path)
     goto posix_err;
   }
 
-  ret = open(disk_path, O_RDWR);
+  ret = open(disk_path, read_only ? O_RDONLY : O_RDWR);
   if (ret < 0) {
     POSIX_ERROR(errno, "could not open disk '%s'", disk_path);
     goto posix_err;
   }
 
   INIT_LIST_HEAD(&disk->link);
+  hist_init(&disk->read_lat);
+  hist_init(&disk->write_lat);
+  hist_init(&disk->io_size);
   disk->fd = ret;
+  disk->read_only = read_only;
   ret = fstat(disk->fd, &disk->st);
   ON_POSIX_ERROR("disk stat", ret, posix_err);
+
+  if (read_only) {
+    disk_map(disk);
+  }
+
+  if (disk->map == NULL &&
+      disk_start_worker(disk) != ERR_NONE) {
+    goto posix_err;
+  }
+
   list_add_tail(&disk->link, &disks);
 
   return disk;
  posix_err:
   if (disk != NULL) {
+    if (disk->map != NULL) {
+      munmap(disk->map, disk->st.st_size);
+    }
+    if (disk->fd > 0) {
+      close(disk->fd);
+    }
     if (disk->path != NULL) {
       free(disk->path);
     }
@@ -112,6 +443,38 @@ disk_open(const char *disk_path)
   return NULL;
 }
 
+int
+disk_io_stats_format(disk_io_stats_t *s,
+                     char *buf,
+                     length_t size)
+{
+  return snprintf(buf, size, "reads %llu (%llu bytes) writes %llu "
+                  "(%llu bytes) seeks %llu seq %llu random %llu",
+                  s->reads, s->read_bytes, s->writes, s->write_bytes,
+                  s->seeks, s->seq, s->random);
+}
+
+static void
+disk_stats_log(disk_t *disk)
+{
+  char buf[256];
+
+  if (disk->stats.reads == 0 && disk->stats.writes == 0) {
+    return;
+  }
+
+  disk_io_stats_format(&disk->stats, buf, sizeof(buf));
+  LOG("%s: %s", disk->path, buf);
+  LOG("%s: readahead hits %llu mapped %llu short %llu", disk->path,
+      disk->ra_hits, disk->mapped, disk->short_io);
+  hist_format(&disk->read_lat, "ns", buf, sizeof(buf));
+  LOG("%s: read latency %s", disk->path, buf);
+  hist_format(&disk->write_lat, "ns", buf, sizeof(buf));
+  LOG("%s: write latency %s", disk->path, buf);
+  hist_format(&disk->io_size, "", buf, sizeof(buf));
+  LOG("%s: request size %s", disk->path, buf);
+}
+
 void
 disk_bye(void)
 {
@@ -119,24 +482,80 @@ disk_bye(void)
   disk_t *n;
 
   list_for_each_entry_safe(disk, n, &disks, link) {
+    disk_stats_log(disk);
+    disk_stop_worker(disk);
+    if (disk->map != NULL) {
+      munmap(disk->map, disk->st.st_size);
+    }
     close(disk->fd);
     list_del(&disk->link);
+    free(disk->parts);
+    free(disk->path);
     free(disk);
   }
 }
 
+static const uint8_t *
+disk_map_range(disk_t *disk,
+               offset_t offset,
+               length_t *len)
+{
+  if (disk->map == NULL) {
+    *len = 0;
+    return NULL;
+  }
+
+  if (offset >= disk->st.st_size) {
+    *len = 0;
+    return NULL;
+  }
+
+  *len = min(*len, (length_t) (disk->st.st_size - offset));
+  return disk->map + offset;
+}
+
+static void
+disk_account(disk_t *disk,
+             bool write,
+             offset_t off,
+             length_t expected,
+             length_t done,
+             uint64_t start)
+{
+  disk_io_account(&disk->stats, write, off, done);
+  hist_record(&disk->io_size, expected);
+  hist_record(write ? &disk->write_lat : &disk->read_lat,
+              hist_time_ns() - start);
+  if (done != expected) {
+    disk->short_io++;
+  }
+}
+
 length_t
 disk_in(disk_t *disk,
         uint8_t *buf,
         length_t expected)
 {
   int ret;
+  offset_t off = disk->pos;
+  uint64_t start = hist_time_ns();
 
-  ret = read(disk->fd, buf, expected);
-  if (ret < 0) {
-    ret = 0;
+  if (disk->map != NULL) {
+    length_t len = expected;
+    const uint8_t *p = disk_map_range(disk, off, &len);
+
+    if (p != NULL) {
+      memcpy(buf, p, len);
+      disk->pos += len;
+    }
+    disk->mapped++;
+    disk_account(disk, false, off, expected, len, start);
+    return len;
   }
 
+  ret = disk_submit(disk, false, off, buf, expected);
+  disk->pos += ret;
+  disk_account(disk, false, off, expected, ret, start);
   return ret;
 }
 
@@ -146,70 +565,436 @@ disk_out(disk_t *disk,
          length_t len)
 {
   int ret;
+  offset_t off = disk->pos;
+  uint64_t start = hist_time_ns();
 
-  ret = write(disk->fd, buf, len);
-  if (ret < 0) {
-    ret = 0;
+  if (disk->read_only) {
+    return 0;
   }
 
+  ret = disk_submit(disk, true, off, (uint8_t *) buf, len);
+  disk->pos += ret;
+
+  /*
+   * Extended and GPT tables can be anywhere, so any write
+   * may have repartitioned the disk.
+   */
+  if (ret > 0) {
+    disk->parts_scanned = false;
+    disk->gen++;
+  }
+  disk_account(disk, true, off, len, ret, start);
   return ret;
 }
 
+uint64_t
+disk_gen(disk_t *disk)
+{
+  return disk->gen;
+}
+
 err_t
 disk_seek(disk_t *disk,
           offset_t offset)
 {
-  int ret;
-
-  ret = lseek(disk->fd, offset, SEEK_SET);
-  if (ret < 0) {
-    return ERR_POSIX;
+  if (disk->map != NULL &&
+      offset > disk->st.st_size) {
+    return ERR_OUT_OF_BOUNDS;
   }
 
+  /*
+   * I/O is all pread/pwrite, so the file offset
+   * is only tracked here.
+   */
+  if (offset != disk->pos) {
+    disk->stats.seeks++;
+  }
+  disk->pos = offset;
   return ERR_NONE;
 }
 
+/*
+ * Callers copy out of the mapping themselves, so only the
+ * access is counted, not its latency.
+ */
+const uint8_t *
+disk_map_at(disk_t *disk,
+            offset_t offset,
+            length_t *len)
+{
+  const uint8_t *p;
+  length_t expected = *len;
+
+  p = disk_map_range(disk, offset, len);
+  if (p != NULL) {
+    disk->mapped++;
+    disk_io_account(&disk->stats, false, offset, *len);
+    hist_record(&disk->io_size, expected);
+  }
+
+  return p;
+}
+
+/*
+ * Sums over all disks, for stats.
+ */
+void
+disk_io_totals(disk_io_stats_t *total)
+{
+  disk_t *disk;
+
+  memset(total, 0, sizeof(*total));
+  list_for_each_entry(disk, &disks, link) {
+    total->reads += disk->stats.reads;
+    total->writes += disk->stats.writes;
+    total->read_bytes += disk->stats.read_bytes;
+    total->write_bytes += disk->stats.write_bytes;
+    total->seeks += disk->stats.seeks;
+    total->seq += disk->stats.seq;
+    total->random += disk->stats.random;
+  }
+}
+
+void
+disk_mon_dump(void)
+{
+  char buf[256];
+  disk_t *disk;
+
+  list_for_each_entry(disk, &disks, link) {
+    mon_printf("%s (%s%s):\n", disk->path,
+               disk->read_only ? "ro" : "rw",
+               disk->map != NULL ? ", mapped" :
+               disk->has_worker ? ", worker" : "");
+    disk_io_stats_format(&disk->stats, buf, sizeof(buf));
+    mon_printf("  %s\n", buf);
+    mon_printf("  readahead hits %llu mapped %llu short %llu\n",
+               disk->ra_hits, disk->mapped, disk->short_io);
+    hist_format(&disk->read_lat, "ns", buf, sizeof(buf));
+    mon_printf("  read latency:  %s\n", buf);
+    hist_format(&disk->write_lat, "ns", buf, sizeof(buf));
+    mon_printf("  write latency: %s\n", buf);
+    hist_format(&disk->io_size, "", buf, sizeof(buf));
+    mon_printf("  request size:  %s\n", buf);
+  }
+}
+
+static void
+disk_advise(disk_t *disk,
+            disk_part_t *part)
+{
+  uintptr_t start;
+  uintptr_t end;
+
+  if (disk->map == NULL || part->length == 0) {
+    return;
+  }
+
+  /*
+   * Loaders mostly stream through whatever partition they
+   * opened, so let the pager read ahead aggressively and
+   * start faulting in the head of it.
+   */
+  start = ALIGN((uintptr_t) disk->map + part->off, vm_page_size);
+  end = (uintptr_t) disk->map + min((off_t) part->off + part->length,
+                                    disk->st.st_size);
+  if (start >= end) {
+    return;
+  }
+  madvise((void *) start, end - start, MADV_SEQUENTIAL);
+
+  end = min(end, (uintptr_t) disk->map + part->off + DISK_WILLNEED_BYTES);
+  madvise((void *) start, end - start, MADV_WILLNEED);
+}
+
 err_t
-disk_find_part(disk_t *disk,
-               unsigned index,
-               disk_part_t *part)
+disk_read_at(disk_t *disk,
+             uint64_t offset,
+             uint8_t *buf,
+             length_t len)
 {
-  uint8_t blk[SECTOR_SIZE];
-  dos_part_t *d;
-  length_t len;
-  unsigned i;
   err_t err;
 
-  if (index == 0) {
-    part->off = 0;
-    part->length = disk->st.st_size;
-    return ERR_NONE;
+  /*
+   * Offsets come from on-disk tables, and disk_seek
+   * only takes an offset_t.
+   */
+  if (offset + len > (offset_t) -1) {
+    return ERR_OUT_OF_BOUNDS;
   }
 
-  err = disk_seek(disk, 0);
+  err = disk_seek(disk, offset);
   if (err != ERR_NONE) {
     return err;
   }
 
-  len = disk_in(disk, blk, SECTOR_SIZE);
-  if (len != SECTOR_SIZE) {
+  if (disk_in(disk, buf, len) != len) {
     return ERR_IO_ERROR;
   }
 
-  /* check the MSDOS partition magic */
-  if ((blk[0x1fe] != 0x55) || (blk[0x1ff] != 0xaa)) {
+  return ERR_NONE;
+}
+
+static void
+disk_add_part(disk_t *disk,
+              uint64_t off,
+              uint64_t length)
+{
+  disk_part_t *parts;
+
+  if (off + length > (offset_t) -1) {
+    WARN("%s: partition %u at 0x%llx+0x%llx not addressable, ignoring",
+         disk->path, disk->part_count + 1, off, length);
+    off = length = 0;
+  }
+
+  parts = realloc(disk->parts, (disk->part_count + 1) * sizeof(disk_part_t));
+  BUG_ON(parts == NULL, "partition table alloc");
+
+  disk->parts = parts;
+  disk->parts[disk->part_count].off = off;
+  disk->parts[disk->part_count].length = length;
+  disk->part_count++;
+}
+
+static err_t
+disk_scan_apm(disk_t *disk,
+              uint8_t *blk)
+{
+  err_t err;
+  unsigned i;
+  unsigned count;
+  length_t blk_size;
+  apm_ddm_t *ddm = (apm_ddm_t *) blk;
+  apm_part_t *pm = (apm_part_t *) blk;
+
+  blk_size = be16_to_cpu(ddm->block_size);
+  if (blk_size < SECTOR_SIZE || (blk_size % SECTOR_SIZE) != 0) {
+    blk_size = SECTOR_SIZE;
+  }
+
+  /*
+   * Entry 1 is the partition map itself, and tells us
+   * how many entries there are. Mac OF numbers partitions
+   * the same way, so index N is map entry N.
+   */
+  count = 1;
+  for (i = 1; i <= count; i++) {
+    err = disk_read_at(disk, (uint64_t) i * blk_size, blk, SECTOR_SIZE);
+    if (err != ERR_NONE) {
+      return err;
+    }
+
+    if (be16_to_cpu(pm->signature) != APM_PART_MAGIC) {
+      break;
+    }
+
+    if (i == 1) {
+      count = min(be32_to_cpu(pm->map_count), DISK_MAX_PARTS);
+    }
+
+    disk_add_part(disk, (uint64_t) be32_to_cpu(pm->start_block) * blk_size,
+                  (uint64_t) be32_to_cpu(pm->block_count) * blk_size);
+  }
+
+  return ERR_NONE;
+}
+
+static err_t
+disk_scan_gpt(disk_t *disk,
+              uint8_t *blk)
+{
+  err_t err;
+  unsigned i;
+  unsigned count;
+  uint64_t entry_lba;
+  length_t entry_size;
+  gpt_header_t *h = (gpt_header_t *) blk;
+
+  err = disk_read_at(disk, SECTOR_SIZE, blk, SECTOR_SIZE);
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  if (memcmp(h->signature, GPT_MAGIC, sizeof(h->signature))) {
     return ERR_NOT_FOUND;
   }
 
-  if (index >= 4) {
+  entry_lba = le64_to_cpu(h->entry_lba);
+  count = min(le32_to_cpu(h->entry_count), DISK_MAX_PARTS);
+  entry_size = le32_to_cpu(h->entry_size);
+  if (entry_size < sizeof(gpt_entry_t) || entry_size > SECTOR_SIZE ||
+      (SECTOR_SIZE % entry_size) != 0) {
+    WARN("%s: bad GPT entry size %u", disk->path, entry_size);
     return ERR_NOT_FOUND;
   }
 
-  d = (dos_part_t *) &blk[0x1be];
-  for (i = 1; i != index; i++, d++);
+  /*
+   * GPT numbers partitions by entry slot, so unused slots
+   * before the last used one are kept as empty entries.
+   */
+  for (i = 0; i < count; i++) {
+    gpt_entry_t *e;
+    uint64_t off = entry_lba * SECTOR_SIZE + i * entry_size;
+
+    if ((i * entry_size) % SECTOR_SIZE == 0) {
+      err = disk_read_at(disk, ALIGN(off, SECTOR_SIZE), blk, SECTOR_SIZE);
+      if (err != ERR_NONE) {
+        return err;
+      }
+    }
+
+    e = (gpt_entry_t *) (blk + (off % SECTOR_SIZE));
+    if (!memcmp(e->type, gpt_unused_type, sizeof(e->type)) ||
+        le64_to_cpu(e->last_lba) < le64_to_cpu(e->first_lba)) {
+      continue;
+    }
+
+    while (disk->part_count < i) {
+      disk_add_part(disk, 0, 0);
+    }
+
+    disk_add_part(disk, le64_to_cpu(e->first_lba) * SECTOR_SIZE,
+                  (le64_to_cpu(e->last_lba) - le64_to_cpu(e->first_lba) + 1) *
+                  SECTOR_SIZE);
+  }
+
+  return ERR_NONE;
+}
+
+static bool
+disk_dos_is_extended(uint8_t sys_ind)
+{
+  return sys_ind == DOS_EXTENDED ||
+    sys_ind == DOS_EXTENDED_LBA ||
+    sys_ind == DOS_EXTENDED_LINUX;
+}
+
+static err_t
+disk_scan_dos(disk_t *disk,
+              uint8_t *blk)
+{
+  err_t err;
+  unsigned i;
+  unsigned links;
+  dos_part_t *d;
+  uint64_t ext_base = 0;
+  uint64_t ebr;
+
+  d = (dos_part_t *) &blk[DOS_PART_OFFSET];
+  for (i = 0; i < 4; i++) {
+    if (d[i].sys_ind == DOS_GPT_PROTECTIVE) {
+      return disk_scan_gpt(disk, blk);
+    }
+  }
+
+  /*
+   * Primaries are always 1-4, even if some are empty,
+   * and logical partitions start at 5.
+   */
+  for (i = 0; i < 4; i++) {
+    if (disk_dos_is_extended(d[i].sys_ind)) {
+      ext_base = (uint64_t) le32_to_cpu(d[i].start_sect) * SECTOR_SIZE;
+    }
+
+    disk_add_part(disk, (uint64_t) le32_to_cpu(d[i].start_sect) * SECTOR_SIZE,
+                  (uint64_t) le32_to_cpu(d[i].nr_sects) * SECTOR_SIZE);
+  }
+
+  if (ext_base == 0) {
+    return ERR_NONE;
+  }
+
+  /*
+   * Walk the EBR chain. The first entry of each EBR is the logical
+   * partition (relative to that EBR), the second links to the next
+   * EBR (relative to the start of the extended partition).
+   */
+  ebr = ext_base;
+  for (links = 0; links < DISK_MAX_PARTS; links++) {
+    err = disk_read_at(disk, ebr, blk, SECTOR_SIZE);
+    if (err != ERR_NONE) {
+      return err;
+    }
+
+    if ((blk[0x1fe] != 0x55) || (blk[0x1ff] != 0xaa)) {
+      WARN("%s: bad EBR at 0x%llx", disk->path, ebr);
+      break;
+    }
+
+    if (d[0].nr_sects != 0) {
+      disk_add_part(disk, ebr + (uint64_t) le32_to_cpu(d[0].start_sect) *
+                    SECTOR_SIZE, (uint64_t) le32_to_cpu(d[0].nr_sects) *
+                    SECTOR_SIZE);
+    }
+
+    if (!disk_dos_is_extended(d[1].sys_ind) ||
+        d[1].start_sect == 0) {
+      break;
+    }
+
+    ebr = ext_base + (uint64_t) le32_to_cpu(d[1].start_sect) * SECTOR_SIZE;
+  }
+
+  return ERR_NONE;
+}
+
+static err_t
+disk_scan_parts(disk_t *disk)
+{
+  err_t err;
+  uint8_t blk[SECTOR_SIZE];
+
+  err = disk_read_at(disk, 0, blk, SECTOR_SIZE);
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  if (be16_to_cpu(((apm_ddm_t *) blk)->signature) == APM_DDM_MAGIC) {
+    err = disk_scan_apm(disk, blk);
+  } else if ((blk[0x1fe] == 0x55) && (blk[0x1ff] == 0xaa)) {
+    err = disk_scan_dos(disk, blk);
+  } else {
+    err = ERR_NOT_FOUND;
+  }
+
+  VERBOSE("%s: %u partitions", disk->path, disk->part_count);
+  return err;
+}
+
+err_t
+disk_find_part(disk_t *disk,
+               unsigned index,
+               disk_part_t *part)
+{
+  if (index == 0) {
+    part->off = 0;
+    part->length = disk->st.st_size;
+    disk_advise(disk, part);
+    return ERR_NONE;
+  }
+
+  /*
+   * Partition tables are parsed once per disk and cached
+   * until the guest writes to it.
+   */
+  if (!disk->parts_scanned) {
+    disk->part_count = 0;
+    disk->parts_err = disk_scan_parts(disk);
+    disk->parts_scanned = true;
+  }
+
+  if (disk->parts_err != ERR_NONE && disk->part_count == 0) {
+    return disk->parts_err;
+  }
+
+  if (index > disk->part_count ||
+      disk->parts[index - 1].length == 0) {
+    return ERR_NOT_FOUND;
+  }
 
-  part->off = le32_to_cpu(d->start_sect) * SECTOR_SIZE;
-  part->length = le32_to_cpu(d->nr_sects) * SECTOR_SIZE;
+  *part = disk->parts[index - 1];
+  disk_advise(disk, part);
 
   return ERR_NONE;
 }
@@ -0,0 +1,69 @@
+/*
+ * Decodes an exit trace file written by pvp -t, oldest
+ * record first. Usage: etdump trace.bin ?count
+ */
+
+#include "etrace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int
+main(int argc, char **argv)
+{
+  int fd;
+  uint64_t i;
+  uint64_t first;
+  struct stat st;
+  char buf[256];
+  etrace_hdr_t *hdr;
+  uint64_t count = ~0ULL;
+
+  if (argc != 2 && argc != 3) {
+    fprintf(stderr, "Usage: %s trace.bin [count]\n", argv[0]);
+    return 1;
+  }
+
+  if (argc == 3) {
+    count = strtoull(argv[2], NULL, 0);
+  }
+
+  fd = open(argv[1], O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (hdr == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  if (st.st_size < sizeof(*hdr) ||
+      hdr->magic != ETRACE_MAGIC ||
+      hdr->version != ETRACE_VERSION ||
+      hdr->entries == 0 ||
+      st.st_size < hdr->hdr_size +
+      (uint64_t) hdr->entries * sizeof(etrace_rec_t)) {
+    fprintf(stderr, "%s: not an exit trace\n", argv[1]);
+    return 1;
+  }
+
+  first = hdr->written > hdr->entries ? hdr->written - hdr->entries : 0;
+  if (hdr->written - first > count) {
+    first = hdr->written - count;
+  }
+
+  printf("%llu exits traced, showing %llu\n", hdr->written,
+         hdr->written - first);
+  for (i = first; i < hdr->written; i++) {
+    etrace_format(hdr, i, buf, sizeof(buf));
+    printf("%s\n", buf);
+  }
+
+  munmap(hdr, st.st_size);
+  close(fd);
+  return 0;
+}
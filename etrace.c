@@ -0,0 +1,133 @@
+/*
+ * Binary exit trace into an mmap'ed ring file. Each exit is
+ * a handful of stores into the mapping, with no formatting
+ * and no system calls, and the file is still there to decode
+ * with etdump if pvp goes down. Unlike the console capture,
+ * a new run starts the trace over.
+ */
+
+#define LOG_PFX ETRACE
+#include "etrace.h"
+#include "guest.h"
+#include "rom.h"
+#include "hist.h"
+#include "mon.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+static etrace_hdr_t *hdr;
+static etrace_rec_t *records;
+static length_t map_size;
+static uint32_t mask;
+
+err_t
+etrace_init(const char *path,
+            count_t entries)
+{
+  int fd;
+  int ret;
+  unsigned i;
+  const char *name;
+  length_t hdr_size = ALIGN_UP(sizeof(etrace_hdr_t), PAGE_SIZE);
+
+  if (entries < 2) {
+    entries = 2;
+  }
+  entries = 1U << (32 - __builtin_clz(entries - 1));
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    POSIX_ERROR(errno, "could not open exit trace '%s'", path);
+    return ERR_POSIX;
+  }
+
+  map_size = hdr_size + ALIGN_UP(entries * sizeof(etrace_rec_t), PAGE_SIZE);
+  ret = ftruncate(fd, map_size);
+  ON_POSIX_ERROR("ftruncate", ret, posix_err);
+
+  hdr = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+  if (hdr == MAP_FAILED) {
+    hdr = NULL;
+    ret = -1;
+    ON_POSIX_ERROR("mmap", ret, posix_err);
+  }
+  close(fd);
+  fd = -1;
+
+  hdr->magic = ETRACE_MAGIC;
+  hdr->version = ETRACE_VERSION;
+  hdr->hdr_size = hdr_size;
+  hdr->entries = entries;
+  hdr->start_ns = hist_time_ns();
+  for (i = 0; i < ETRACE_CIFS &&
+         (name = rom_service_name(i + 1)) != NULL; i++) {
+    strlcpy(hdr->cif[i], name, ETRACE_NAME_LEN);
+  }
+
+  records = (etrace_rec_t *) ((char *) hdr + hdr_size);
+  mask = entries - 1;
+
+  LOG("tracing exits to '%s' (%u entries)", path, entries);
+  return ERR_NONE;
+
+ posix_err:
+  if (fd >= 0) {
+    close(fd);
+  }
+  return ERR_POSIX;
+}
+
+void
+etrace_exit(vmm_return_code_t code,
+            uint64_t time_ns)
+{
+  etrace_rec_t *r;
+  unsigned long *params;
+
+  if (hdr == NULL) {
+    return;
+  }
+
+  r = records + (hdr->written & mask);
+  params = guest->vmm->vmmRet.vmmrp32.return_params;
+  r->time_ns = time_ns - hdr->start_ns;
+  r->code = code;
+  r->pc = guest->exit_pc;
+  r->lr = guest->regs->ppcLR;
+  r->dar = params[0];
+  r->dsisr = params[1];
+  r->cif = rom_last_service_id();
+  hdr->written++;
+}
+
+void
+etrace_tail(count_t count)
+{
+  uint64_t i;
+  char buf[256];
+
+  if (hdr == NULL) {
+    mon_printf("exit trace is off (-t file)\n");
+    return;
+  }
+
+  count = min((uint64_t) count, min(hdr->written, (uint64_t) hdr->entries));
+  for (i = hdr->written - count; i < hdr->written; i++) {
+    etrace_format(hdr, i, buf, sizeof(buf));
+    mon_printf("%s\n", buf);
+  }
+}
+
+void
+etrace_bye(void)
+{
+  if (hdr == NULL) {
+    return;
+  }
+
+  LOG("traced %llu exits", hdr->written);
+  munmap(hdr, map_size);
+  hdr = NULL;
+}
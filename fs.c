@@ -0,0 +1,956 @@
+/*
+ * Read-only FAT12/16/32 and ISO9660 access to disk partitions,
+ * so loaders can open "dev:part,file" inside disk images.
+ *
+ * Resolved paths are kept in a per-mount directory entry cache,
+ * and each cached entry remembers its cluster chain as a list of
+ * contiguous extents, so repeated opens and reads of the same file
+ * don't walk directories or the FAT again.
+ *
+ * Not supported: Joliet, Rock Ridge, multi-extent ISO9660 files.
+ */
+
+#define LOG_PFX FS
+#include "fs.h"
+#include "list.h"
+
+#include <ctype.h>
+#include <strings.h>
+
+#define FS_DCACHE_BUCKETS 64
+#define FS_MAX_FAT_BYTES  MB(16)
+
+#define FAT_ATTR_VOLUME   0x08
+#define FAT_ATTR_DIR      0x10
+#define FAT_ATTR_LFN      0x0f
+#define FAT_DIRENT_SIZE   32
+#define FAT_LFN_CHARS     13
+#define FAT_LFN_ORDS      20
+
+#define ISO_SECTOR_SIZE   2048
+#define ISO_PVD_SECTOR    16
+#define ISO_FLAG_DIR      0x02
+#define ISO_FLAG_MULTI    0x80
+
+typedef enum {
+  FS_FAT,
+  FS_ISO9660,
+} fs_type_t;
+
+typedef struct {
+  offset_t file_off;
+  uint64_t disk_off;
+  length_t len;
+} fs_extent_t;
+
+typedef struct fs_node_s {
+  struct list_head link;
+  char *path;
+  bool dir;
+  /*
+   * First cluster (FAT) or first block (ISO9660).
+   */
+  uint32_t start;
+  length_t size;
+  unsigned extent_count;
+  fs_extent_t *extents;
+} fs_node_t;
+
+struct fs_s {
+  struct list_head link;
+  fs_type_t type;
+  disk_t *disk;
+  disk_part_t part;
+  /*
+   * disk_gen() at mount time. A stale mount is dropped from
+   * mounts, but lives on until its last file is closed.
+   */
+  uint64_t gen;
+  count_t files;
+  struct list_head dcache[FS_DCACHE_BUCKETS];
+  fs_node_t *root;
+
+  /*
+   * FAT. Offsets are relative to the partition.
+   */
+  unsigned fat_bits;
+  uint8_t *fat;
+  length_t fat_bytes;
+  length_t cluster_size;
+  uint32_t cluster_count;
+  uint64_t data_off;
+
+  /*
+   * ISO9660.
+   */
+  length_t block_size;
+};
+
+struct fs_file_s {
+  fs_t *fs;
+  fs_node_t *node;
+};
+
+static LIST_HEAD(mounts);
+
+static inline uint16_t
+fs_le16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t
+fs_le32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static unsigned
+fs_hash(const char *s)
+{
+  unsigned h = 5381;
+
+  while (*s != '\0') {
+    h = h * 33 + (uint8_t) *s++;
+  }
+
+  return h % FS_DCACHE_BUCKETS;
+}
+
+static err_t
+fs_disk_read(fs_t *fs,
+             uint64_t off,
+             uint8_t *buf,
+             length_t len)
+{
+  if (off + len > fs->part.length) {
+    return ERR_OUT_OF_BOUNDS;
+  }
+
+  return disk_read_at(fs->disk, fs->part.off + off, buf, len);
+}
+
+static fs_node_t *
+fs_node_alloc(const char *path,
+              bool dir,
+              uint32_t start,
+              length_t size)
+{
+  fs_node_t *node;
+
+  node = malloc(sizeof(*node));
+  if (node == NULL) {
+    return NULL;
+  }
+  memset(node, 0, sizeof(*node));
+
+  node->path = strdup(path);
+  if (node->path == NULL) {
+    free(node);
+    return NULL;
+  }
+
+  INIT_LIST_HEAD(&node->link);
+  node->dir = dir;
+  node->start = start;
+  node->size = size;
+  return node;
+}
+
+static void
+fs_node_free(fs_node_t *node)
+{
+  list_del(&node->link);
+  free(node->extents);
+  free(node->path);
+  free(node);
+}
+
+static err_t
+fs_node_add_extent(fs_node_t *node,
+                   offset_t file_off,
+                   uint64_t disk_off,
+                   length_t len)
+{
+  fs_extent_t *e;
+
+  if (node->extent_count != 0) {
+    e = &node->extents[node->extent_count - 1];
+    if (e->disk_off + e->len == disk_off) {
+      e->len += len;
+      return ERR_NONE;
+    }
+  }
+
+  e = realloc(node->extents, (node->extent_count + 1) * sizeof(*e));
+  if (e == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  node->extents = e;
+  e += node->extent_count++;
+  e->file_off = file_off;
+  e->disk_off = disk_off;
+  e->len = len;
+  return ERR_NONE;
+}
+
+static uint32_t
+fs_fat_next(fs_t *fs,
+            uint32_t cluster)
+{
+  uint32_t v;
+
+  if (fs->fat_bits == 12) {
+    v = fs_le16(fs->fat + cluster + cluster / 2);
+    v = (cluster & 1) ? v >> 4 : v & 0xfff;
+    return v >= 0xff8 ? 0 : v;
+  } else if (fs->fat_bits == 16) {
+    v = fs_le16(fs->fat + cluster * 2);
+    return v >= 0xfff8 ? 0 : v;
+  }
+
+  v = fs_le32(fs->fat + cluster * 4) & 0x0fffffff;
+  return v >= 0x0ffffff8 ? 0 : v;
+}
+
+/*
+ * Turns the node's cluster chain (or ISO9660 extent) into a list
+ * of contiguous extents. Done once per cached node.
+ */
+static err_t
+fs_node_resolve(fs_t *fs,
+                fs_node_t *node)
+{
+  err_t err;
+  uint32_t cluster;
+  uint32_t walked;
+  offset_t file_off;
+
+  if (node->extents != NULL || node->start == 0) {
+    return ERR_NONE;
+  }
+
+  if (fs->type == FS_ISO9660) {
+    return fs_node_add_extent(node, 0, (uint64_t) node->start *
+                              fs->block_size, node->size);
+  }
+
+  file_off = 0;
+  cluster = node->start;
+  for (walked = 0; cluster != 0; walked++) {
+    if (cluster < 2 || cluster >= fs->cluster_count + 2 ||
+        walked > fs->cluster_count) {
+      WARN("%s: bad cluster chain at 0x%x", node->path, cluster);
+      return ERR_IO_ERROR;
+    }
+
+    err = fs_node_add_extent(node, file_off, fs->data_off +
+                             (uint64_t) (cluster - 2) * fs->cluster_size,
+                             fs->cluster_size);
+    if (err != ERR_NONE) {
+      return err;
+    }
+
+    file_off += fs->cluster_size;
+    cluster = fs_fat_next(fs, cluster);
+  }
+
+  if (node->dir) {
+    node->size = file_off;
+  }
+
+  return ERR_NONE;
+}
+
+static fs_extent_t *
+fs_node_extent(fs_node_t *node,
+               offset_t off)
+{
+  unsigned lo = 0;
+  unsigned hi = node->extent_count;
+
+  while (lo < hi) {
+    unsigned mid = (lo + hi) / 2;
+    fs_extent_t *e = &node->extents[mid];
+
+    if (off < e->file_off) {
+      hi = mid;
+    } else if (off >= e->file_off + e->len) {
+      lo = mid + 1;
+    } else {
+      return e;
+    }
+  }
+
+  return NULL;
+}
+
+static length_t
+fs_node_read(fs_t *fs,
+             fs_node_t *node,
+             offset_t off,
+             uint8_t *buf,
+             length_t len)
+{
+  length_t done = 0;
+
+  if (off >= node->size) {
+    return 0;
+  }
+  len = min(len, node->size - off);
+
+  while (done != len) {
+    length_t xfer;
+    fs_extent_t *e = fs_node_extent(node, off + done);
+
+    if (e == NULL) {
+      break;
+    }
+
+    xfer = min(len - done, e->len - (off + done - e->file_off));
+    if (fs_disk_read(fs, e->disk_off + (off + done - e->file_off),
+                     buf + done, xfer) != ERR_NONE) {
+      break;
+    }
+
+    done += xfer;
+  }
+
+  return done;
+}
+
+static void
+fs_fat_dirent_name(const uint8_t *e,
+                   char *name)
+{
+  int i;
+  char *p = name;
+
+  for (i = 0; i < 8 && e[i] != ' '; i++) {
+    *p++ = (i == 0 && e[i] == 0x05) ? 0xe5 : e[i];
+  }
+
+  if (e[8] != ' ') {
+    *p++ = '.';
+    for (i = 8; i < 11 && e[i] != ' '; i++) {
+      *p++ = e[i];
+    }
+  }
+
+  *p = '\0';
+}
+
+/*
+ * LFN entries come last part first, the first one flagged
+ * with 0x40. Returns the ordinal of e if it continues the
+ * sequence whose previous ordinal was prev, or 0, so lfn
+ * holds a whole name once ordinal 1 is in.
+ */
+static unsigned
+fs_fat_lfn_collect(const uint8_t *e,
+                   unsigned prev,
+                   char *lfn)
+{
+  unsigned i;
+  unsigned base;
+  unsigned ord = e[0] & 0x1f;
+  bool last = (e[0] & 0x40) != 0;
+  static const uint8_t offs[FAT_LFN_CHARS] = {
+    1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30
+  };
+
+  if (ord == 0 || ord > FAT_LFN_ORDS ||
+      (!last && ord + 1 != prev)) {
+    return 0;
+  }
+
+  base = (ord - 1) * FAT_LFN_CHARS;
+  for (i = 0; i < FAT_LFN_CHARS; i++) {
+    uint16_t c = fs_le16(e + offs[i]);
+
+    if (c == 0 || c == 0xffff) {
+      break;
+    }
+
+    lfn[base + i] = c < 0x80 ? c : '?';
+  }
+
+  if (last || i < FAT_LFN_CHARS) {
+    lfn[base + i] = '\0';
+  }
+
+  return ord;
+}
+
+static err_t
+fs_fat_lookup(fs_t *fs,
+              uint8_t *dir,
+              length_t dir_len,
+              const char *name,
+              bool *is_dir,
+              uint32_t *start,
+              length_t *size)
+{
+  offset_t off;
+  unsigned ord = 0;
+  char lfn[FAT_LFN_ORDS * FAT_LFN_CHARS + 1];
+  char short_name[13];
+
+  for (off = 0; off + FAT_DIRENT_SIZE <= dir_len;
+       off += FAT_DIRENT_SIZE) {
+    uint8_t *e = dir + off;
+    uint8_t attr = e[11];
+
+    if (e[0] == 0) {
+      break;
+    } else if (e[0] == 0xe5) {
+      ord = 0;
+      continue;
+    }
+
+    if (attr == FAT_ATTR_LFN) {
+      ord = fs_fat_lfn_collect(e, ord, lfn);
+      continue;
+    }
+
+    if ((attr & FAT_ATTR_VOLUME) != 0) {
+      ord = 0;
+      continue;
+    }
+
+    fs_fat_dirent_name(e, short_name);
+    if (!strcasecmp(name, short_name) ||
+        (ord == 1 && !strcasecmp(name, lfn))) {
+      *is_dir = (attr & FAT_ATTR_DIR) != 0;
+      *start = fs_le16(e + 26) | (fs_le16(e + 20) << 16);
+      *size = fs_le32(e + 28);
+      return ERR_NONE;
+    }
+
+    ord = 0;
+  }
+
+  return ERR_NOT_FOUND;
+}
+
+static err_t
+fs_iso_lookup(fs_t *fs,
+              uint8_t *dir,
+              length_t dir_len,
+              const char *name,
+              bool *is_dir,
+              uint32_t *start,
+              length_t *size)
+{
+  offset_t off;
+  char rec_name[256];
+
+  for (off = 0; off < dir_len; ) {
+    uint8_t *r = dir + off;
+    uint8_t len = r[0];
+    uint8_t name_len;
+    char *p;
+
+    if (len == 0) {
+      /*
+       * Records don't straddle sectors, the rest is padding.
+       */
+      off = ALIGN(off + ISO_SECTOR_SIZE, ISO_SECTOR_SIZE);
+      continue;
+    }
+
+    if (len < 34 || off + len > dir_len) {
+      break;
+    }
+
+    off += len;
+    name_len = r[32];
+    if (33 + name_len > len) {
+      break;
+    }
+
+    if (name_len == 1 && (r[33] == 0 || r[33] == 1)) {
+      continue;
+    }
+
+    memcpy(rec_name, r + 33, name_len);
+    rec_name[name_len] = '\0';
+    p = strchr(rec_name, ';');
+    if (p != NULL) {
+      *p = '\0';
+    }
+
+    p = rec_name + strlen(rec_name);
+    if (p != rec_name && p[-1] == '.') {
+      p[-1] = '\0';
+    }
+
+    if (strcasecmp(name, rec_name)) {
+      continue;
+    }
+
+    if ((r[25] & ISO_FLAG_MULTI) != 0) {
+      WARN("multi-extent file '%s' not supported", rec_name);
+      return ERR_UNSUPPORTED;
+    }
+
+    *is_dir = (r[25] & ISO_FLAG_DIR) != 0;
+    *start = fs_le32(r + 2);
+    *size = fs_le32(r + 10);
+    return ERR_NONE;
+  }
+
+  return ERR_NOT_FOUND;
+}
+
+static fs_node_t *
+fs_dcache_find(fs_t *fs,
+               const char *path)
+{
+  fs_node_t *node;
+
+  list_for_each_entry(node, &fs->dcache[fs_hash(path)], link) {
+    if (!strcmp(node->path, path)) {
+      return node;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * path is normalized: upper case, '/'-separated,
+ * no leading or duplicate separators.
+ */
+static err_t
+fs_lookup(fs_t *fs,
+          char *path,
+          fs_node_t **out)
+{
+  err_t err;
+  char *name;
+  bool is_dir;
+  uint32_t start;
+  length_t size;
+  uint8_t *dir_data;
+  fs_node_t *dir;
+  fs_node_t *node;
+
+  node = fs_dcache_find(fs, path);
+  if (node != NULL) {
+    *out = node;
+    return ERR_NONE;
+  }
+
+  name = strrchr(path, '/');
+  if (name == NULL) {
+    dir = fs->root;
+    name = path;
+  } else {
+    *name = '\0';
+    err = fs_lookup(fs, path, &dir);
+    *name = '/';
+    if (err != ERR_NONE) {
+      return err;
+    }
+    name++;
+  }
+
+  if (!dir->dir) {
+    return ERR_NOT_FOUND;
+  }
+
+  err = fs_node_resolve(fs, dir);
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  dir_data = malloc(dir->size);
+  if (dir_data == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  if (fs_node_read(fs, dir, 0, dir_data, dir->size) != dir->size) {
+    free(dir_data);
+    return ERR_IO_ERROR;
+  }
+
+  if (fs->type == FS_FAT) {
+    err = fs_fat_lookup(fs, dir_data, dir->size, name,
+                        &is_dir, &start, &size);
+  } else {
+    err = fs_iso_lookup(fs, dir_data, dir->size, name,
+                        &is_dir, &start, &size);
+  }
+  free(dir_data);
+
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  node = fs_node_alloc(path, is_dir, start, size);
+  if (node == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  list_add(&node->link, &fs->dcache[fs_hash(path)]);
+  *out = node;
+  return ERR_NONE;
+}
+
+static err_t
+fs_fat_probe(fs_t *fs,
+             const uint8_t *bpb)
+{
+  err_t err;
+  uint64_t root_off;
+  length_t sector_size = fs_le16(bpb + 11);
+  uint8_t sec_per_clus = bpb[13];
+  uint16_t rsvd = fs_le16(bpb + 14);
+  uint8_t num_fats = bpb[16];
+  uint16_t root_ents = fs_le16(bpb + 17);
+  uint32_t total = fs_le16(bpb + 19);
+  uint32_t fat_sz = fs_le16(bpb + 22);
+  uint32_t root_sectors;
+  uint32_t data_sectors;
+
+  if ((bpb[0] != 0xeb && bpb[0] != 0xe9) ||
+      bpb[510] != 0x55 || bpb[511] != 0xaa) {
+    return ERR_NOT_FOUND;
+  }
+
+  if ((sector_size != 512 && sector_size != 1024 &&
+       sector_size != 2048 && sector_size != 4096) ||
+      sec_per_clus == 0 || (sec_per_clus & (sec_per_clus - 1)) != 0 ||
+      num_fats == 0 || rsvd == 0) {
+    return ERR_NOT_FOUND;
+  }
+
+  if (total == 0) {
+    total = fs_le32(bpb + 32);
+  }
+
+  if (fat_sz == 0) {
+    fat_sz = fs_le32(bpb + 36);
+  }
+
+  root_sectors = ALIGN_UP(root_ents * FAT_DIRENT_SIZE, sector_size) /
+    sector_size;
+  data_sectors = total - rsvd - num_fats * fat_sz - root_sectors;
+
+  fs->type = FS_FAT;
+  fs->cluster_size = sector_size * sec_per_clus;
+  fs->cluster_count = data_sectors / sec_per_clus;
+  if (fs->cluster_count < 4085) {
+    fs->fat_bits = 12;
+  } else if (fs->cluster_count < 65525) {
+    fs->fat_bits = 16;
+  } else {
+    fs->fat_bits = 32;
+  }
+
+  fs->fat_bytes = fat_sz * sector_size;
+  if (fs->fat_bytes > FS_MAX_FAT_BYTES ||
+      fs->fat_bytes < (fs->cluster_count + 2) * fs->fat_bits / 8) {
+    WARN("unsupported FAT size 0x%x", fs->fat_bytes);
+    return ERR_UNSUPPORTED;
+  }
+
+  fs->fat = malloc(fs->fat_bytes);
+  if (fs->fat == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  err = fs_disk_read(fs, (uint64_t) rsvd * sector_size, fs->fat,
+                     fs->fat_bytes);
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  root_off = (uint64_t) (rsvd + num_fats * fat_sz) * sector_size;
+  fs->data_off = root_off + root_sectors * sector_size;
+
+  if (fs->fat_bits == 32) {
+    fs->root = fs_node_alloc("", true, fs_le32(bpb + 44), 0);
+    if (fs->root == NULL) {
+      return ERR_NO_MEM;
+    }
+  } else {
+    /*
+     * FAT12/16 root directory lives in a fixed
+     * area before the data clusters.
+     */
+    fs->root = fs_node_alloc("", true, 0, root_sectors * sector_size);
+    if (fs->root == NULL) {
+      return ERR_NO_MEM;
+    }
+
+    err = fs_node_add_extent(fs->root, 0, root_off, fs->root->size);
+    if (err != ERR_NONE) {
+      return err;
+    }
+  }
+
+  return ERR_NONE;
+}
+
+static err_t
+fs_iso_probe(fs_t *fs)
+{
+  err_t err;
+  uint8_t *root;
+  uint8_t pvd[ISO_SECTOR_SIZE];
+
+  err = fs_disk_read(fs, ISO_PVD_SECTOR * ISO_SECTOR_SIZE, pvd,
+                     sizeof(pvd));
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  if (pvd[0] != 1 || memcmp(pvd + 1, "CD001", 5)) {
+    return ERR_NOT_FOUND;
+  }
+
+  fs->type = FS_ISO9660;
+  fs->block_size = fs_le16(pvd + 128);
+  if (fs->block_size == 0) {
+    fs->block_size = ISO_SECTOR_SIZE;
+  }
+
+  root = pvd + 156;
+  fs->root = fs_node_alloc("", true, fs_le32(root + 2),
+                           fs_le32(root + 10));
+  if (fs->root == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  return ERR_NONE;
+}
+
+static void
+fs_free(fs_t *fs)
+{
+  unsigned i;
+  fs_node_t *node;
+  fs_node_t *n;
+
+  for (i = 0; i < FS_DCACHE_BUCKETS; i++) {
+    list_for_each_entry_safe(node, n, &fs->dcache[i], link) {
+      fs_node_free(node);
+    }
+  }
+
+  if (fs->root != NULL) {
+    fs_node_free(fs->root);
+  }
+
+  free(fs->fat);
+  free(fs);
+}
+
+static void
+fs_unmount(fs_t *fs)
+{
+  list_del_init(&fs->link);
+  if (fs->files == 0) {
+    fs_free(fs);
+  }
+}
+
+fs_t *
+fs_mount(disk_t *disk,
+         disk_part_t *part)
+{
+  fs_t *fs;
+  err_t err;
+  unsigned i;
+  uint8_t bpb[512];
+
+  list_for_each_entry(fs, &mounts, link) {
+    if (fs->disk == disk && fs->part.off == part->off) {
+      if (fs->gen == disk_gen(disk)) {
+        return fs;
+      }
+
+      VERBOSE("disk written since %s was mounted, remounting",
+              fs_name(fs));
+      fs_unmount(fs);
+      break;
+    }
+  }
+
+  fs = malloc(sizeof(*fs));
+  if (fs == NULL) {
+    return NULL;
+  }
+  memset(fs, 0, sizeof(*fs));
+
+  INIT_LIST_HEAD(&fs->link);
+  for (i = 0; i < FS_DCACHE_BUCKETS; i++) {
+    INIT_LIST_HEAD(&fs->dcache[i]);
+  }
+  fs->disk = disk;
+  fs->part = *part;
+  fs->gen = disk_gen(disk);
+
+  err = fs_disk_read(fs, 0, bpb, sizeof(bpb));
+  if (err == ERR_NONE) {
+    err = fs_fat_probe(fs, bpb);
+  }
+
+  if (err == ERR_NOT_FOUND || err == ERR_OUT_OF_BOUNDS) {
+    err = fs_iso_probe(fs);
+  }
+
+  if (err != ERR_NONE) {
+    fs_unmount(fs);
+    return NULL;
+  }
+
+  INIT_LIST_HEAD(&fs->root->link);
+  list_add_tail(&fs->link, &mounts);
+  VERBOSE("mounted %s at partition offset 0x%x", fs_name(fs),
+          part->off);
+  return fs;
+}
+
+const char *
+fs_name(fs_t *fs)
+{
+  if (fs->type == FS_ISO9660) {
+    return "ISO9660";
+  } else if (fs->fat_bits == 12) {
+    return "FAT12";
+  } else if (fs->fat_bits == 16) {
+    return "FAT16";
+  }
+
+  return "FAT32";
+}
+
+err_t
+fs_open(fs_t *fs,
+        const char *path,
+        fs_file_t **file)
+{
+  err_t err;
+  char *p;
+  char *q;
+  char *norm;
+  fs_node_t *node;
+  fs_file_t *f;
+
+  norm = malloc(strlen(path) + 1);
+  if (norm == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  /*
+   * NT loaders use '\', everyone else '/'.
+   */
+  for (p = (char *) path, q = norm; *p != '\0'; p++) {
+    char c = *p == '\\' ? '/' : toupper(*p);
+
+    if (c == '/' && (q == norm || q[-1] == '/')) {
+      continue;
+    }
+    *q++ = c;
+  }
+  if (q != norm && q[-1] == '/') {
+    q--;
+  }
+  *q = '\0';
+
+  if (*norm == '\0') {
+    node = fs->root;
+    err = ERR_NONE;
+  } else {
+    err = fs_lookup(fs, norm, &node);
+  }
+  free(norm);
+
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  err = fs_node_resolve(fs, node);
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  f = malloc(sizeof(*f));
+  if (f == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  f->fs = fs;
+  f->node = node;
+  fs->files++;
+  *file = f;
+  return ERR_NONE;
+}
+
+void
+fs_close(fs_file_t *file)
+{
+  fs_t *fs = file->fs;
+
+  free(file);
+  if (--fs->files == 0 && list_empty(&fs->link)) {
+    fs_free(fs);
+  }
+}
+
+length_t
+fs_size(fs_file_t *file)
+{
+  return file->node->size;
+}
+
+length_t
+fs_read(fs_file_t *file,
+        offset_t off,
+        uint8_t *buf,
+        length_t len)
+{
+  return fs_node_read(file->fs, file->node, off, buf, len);
+}
+
+const uint8_t *
+fs_map_at(fs_file_t *file,
+          offset_t off,
+          length_t *len)
+{
+  fs_extent_t *e;
+  fs_t *fs = file->fs;
+  fs_node_t *node = file->node;
+
+  if (off >= node->size) {
+    *len = 0;
+    return NULL;
+  }
+
+  e = fs_node_extent(node, off);
+  if (e == NULL) {
+    *len = 0;
+    return NULL;
+  }
+
+  *len = min(*len, node->size - off);
+  *len = min(*len, e->len - (off - e->file_off));
+  return disk_map_at(fs->disk, fs->part.off + e->disk_off +
+                     (off - e->file_off), len);
+}
+
+void
+fs_bye(void)
+{
+  fs_t *fs;
+  fs_t *n;
+
+  list_for_each_entry_safe(fs, n, &mounts, link) {
+    list_del(&fs->link);
+    fs_free(fs);
+  }
+}
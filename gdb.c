@@ -0,0 +1,611 @@
+/*
+ * GDB remote serial protocol stub, all-stop with a single thread.
+ *
+ * While the guest runs, only ^C is looked for. Once it stops
+ * (breakpoint, step, ^C or anything the monitor would otherwise
+ * be entered for) packets are handled here until gdb resumes.
+ *
+ * Registers follow the classic 32-bit PowerPC layout gdb uses
+ * without a target description: r0-r31, f0-f31, pc, msr, cr,
+ * lr, ctr, xer, fpscr. MSR, FPRs and FPSCR are read-only.
+ */
+
+#define LOG_PFX GDB
+#include "gdb.h"
+#include "socket.h"
+#include "guest.h"
+#include "bp.h"
+
+#define PORT     7002
+#define PKT_SIZE 4096
+
+#define SIGINT  2
+#define SIGILL  4
+#define SIGTRAP 5
+#define SIGSEGV 11
+
+#define REG_F0    32
+#define REG_PC    64
+#define REG_MSR   65
+#define REG_CR    66
+#define REG_LR    67
+#define REG_CTR   68
+#define REG_XER   69
+#define REG_FPSCR 70
+#define REG_COUNT 71
+
+static socket_t s;
+static bool attach;
+static bool resumed;
+static bool stepping;
+static int last_sig = SIGTRAP;
+
+static enum {
+  PKT_IDLE,
+  PKT_DATA,
+  PKT_CSUM1,
+  PKT_CSUM2,
+} pkt_state;
+static char pkt[PKT_SIZE];
+static length_t pkt_len;
+static uint8_t pkt_csum;
+static uint8_t pkt_their_csum;
+
+static const char hexchars[] = "0123456789abcdef";
+
+static int
+gdb_unhex(char c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+
+  return -1;
+}
+
+/*
+ * Parses hex up to the first non-hex character, which
+ * is returned through end.
+ */
+static uint32_t
+gdb_scan(const char *p, const char **end)
+{
+  uint32_t v = 0;
+
+  while (gdb_unhex(*p) >= 0) {
+    v = (v << 4) | gdb_unhex(*p);
+    p++;
+  }
+
+  *end = p;
+  return v;
+}
+
+static char *
+gdb_hex(char *out, const uint8_t *in, length_t len)
+{
+  while (len--) {
+    *out++ = hexchars[*in >> 4];
+    *out++ = hexchars[*in & 0xf];
+    in++;
+  }
+
+  *out = '\0';
+  return out;
+}
+
+static length_t
+gdb_bin(uint8_t *out, const char *in, length_t len)
+{
+  length_t i;
+
+  for (i = 0; i < len; i++) {
+    int hi = gdb_unhex(in[i * 2]);
+    int lo = hi < 0 ? -1 : gdb_unhex(in[i * 2 + 1]);
+
+    if (lo < 0) {
+      break;
+    }
+
+    out[i] = (hi << 4) | lo;
+  }
+
+  return i;
+}
+
+static void
+gdb_send(const char *data)
+{
+  char trailer[4];
+  uint8_t csum = 0;
+  const char *p;
+  struct iovec iov[3];
+
+  for (p = data; *p != '\0'; p++) {
+    csum += *p;
+  }
+
+  trailer[0] = '#';
+  trailer[1] = hexchars[csum >> 4];
+  trailer[2] = hexchars[csum & 0xf];
+
+  iov[0].iov_base = "$";
+  iov[0].iov_len = 1;
+  iov[1].iov_base = (void *) data;
+  iov[1].iov_len = p - data;
+  iov[2].iov_base = trailer;
+  iov[2].iov_len = 3;
+  socket_outv(&s, iov, ARRAY_LEN(iov));
+}
+
+/*
+ * Register values go in target byte order.
+ */
+static char *
+gdb_hex_reg(char *out, const uint8_t *be, length_t len)
+{
+  length_t i;
+  uint8_t v[8];
+
+  for (i = 0; i < len; i++) {
+    v[i] = guest_is_little() ? be[len - 1 - i] : be[i];
+  }
+
+  return gdb_hex(out, v, len);
+}
+
+static bool
+gdb_bin_reg(uint32_t *reg, const char *in)
+{
+  uint8_t v[4];
+
+  if (gdb_bin(v, in, sizeof(v)) != sizeof(v)) {
+    return false;
+  }
+
+  if (guest_is_little()) {
+    *reg = v[0] | (v[1] << 8) | (v[2] << 16) | ((uint32_t) v[3] << 24);
+  } else {
+    *reg = ((uint32_t) v[0] << 24) | (v[1] << 16) | (v[2] << 8) | v[3];
+  }
+
+  return true;
+}
+
+static uint32_t *
+gdb_reg32(unsigned n)
+{
+  vmm_regs32_t *r = guest->regs;
+
+  if (n < 32) {
+    return (uint32_t *) &r->ppcGPRs[n];
+  }
+
+  switch (n) {
+  case REG_PC:
+    return (uint32_t *) &r->ppcPC;
+  case REG_MSR:
+    return &guest->msr;
+  case REG_CR:
+    return (uint32_t *) &r->ppcCR;
+  case REG_LR:
+    return (uint32_t *) &r->ppcLR;
+  case REG_CTR:
+    return (uint32_t *) &r->ppcCTR;
+  case REG_XER:
+    return (uint32_t *) &r->ppcXER;
+  case REG_FPSCR:
+    return (uint32_t *) &guest->vmm->vmm_proc_state.ppcFPSCR.i[1];
+  }
+
+  return NULL;
+}
+
+static char *
+gdb_get_reg(char *out, unsigned n)
+{
+  uint32_t v;
+  uint8_t be[4];
+
+  if (n >= REG_F0 && n < REG_PC) {
+    return gdb_hex_reg(out, guest->vmm->vmm_proc_state.
+                       ppcFPRs[n - REG_F0].b, 8);
+  }
+
+  v = *gdb_reg32(n);
+  be[0] = v >> 24;
+  be[1] = v >> 16;
+  be[2] = v >> 8;
+  be[3] = v;
+  return gdb_hex_reg(out, be, sizeof(be));
+}
+
+static bool
+gdb_set_reg(unsigned n, const char *in)
+{
+  uint32_t v;
+
+  if (n >= REG_F0 && n < REG_PC) {
+    return true;
+  }
+
+  if (!gdb_bin_reg(&v, in)) {
+    return false;
+  }
+
+  if (n != REG_MSR && n != REG_FPSCR) {
+    *gdb_reg32(n) = v;
+  }
+
+  return true;
+}
+
+static void
+gdb_stop_reply(void)
+{
+  char reply[4];
+
+  reply[0] = 'S';
+  reply[1] = hexchars[last_sig >> 4];
+  reply[2] = hexchars[last_sig & 0xf];
+  reply[3] = '\0';
+  gdb_send(reply);
+}
+
+static err_t
+gdb_resume(bool step, const char *addr)
+{
+  const char *end;
+
+  if (*addr != '\0') {
+    guest->regs->ppcPC = gdb_scan(addr, &end);
+  }
+
+  if (step) {
+    stepping = true;
+    guest_set_ss(true);
+  }
+
+  resumed = true;
+  return ERR_CONTINUE;
+}
+
+static err_t
+gdb_bp(const char *p, bool add)
+{
+  gea_t ea;
+  err_t err;
+  const char *end;
+
+  if ((p[0] != '0' && p[0] != '1') || p[1] != ',') {
+    gdb_send("");
+    return ERR_NONE;
+  }
+
+  ea = gdb_scan(p + 2, &end);
+  err = add ? bp_add(ea) : bp_del(ea);
+  gdb_send(err == ERR_NONE ? "OK" : "E01");
+  return ERR_NONE;
+}
+
+static err_t
+gdb_vcont(const char *p)
+{
+  if (!strcmp(p, "?")) {
+    gdb_send("vCont;c;C;s;S");
+    return ERR_NONE;
+  }
+
+  /*
+   * There's just the one thread, so the first action wins.
+   */
+  if (p[0] == ';') {
+    if (p[1] == 'c' || p[1] == 'C') {
+      return gdb_resume(false, "");
+    } else if (p[1] == 's' || p[1] == 'S') {
+      return gdb_resume(true, "");
+    }
+  }
+
+  gdb_send("");
+  return ERR_NONE;
+}
+
+static err_t
+gdb_handle(char *p)
+{
+  unsigned n;
+  gea_t ea;
+  length_t len;
+  const char *end;
+  char *reply = pkt;
+  char *r;
+  static uint8_t mem[PKT_SIZE / 2];
+
+  switch (*p++) {
+  case '?':
+    gdb_stop_reply();
+    break;
+  case 'g':
+    vmm_call(kVmmGetFloatState, guest->vmm->thread_index);
+    r = reply;
+    for (n = 0; n < REG_COUNT; n++) {
+      r = gdb_get_reg(r, n);
+    }
+    gdb_send(reply);
+    break;
+  case 'G':
+    for (n = 0; n < REG_COUNT; n++) {
+      if (!gdb_set_reg(n, p)) {
+        break;
+      }
+      p += (n >= REG_F0 && n < REG_PC) ? 16 : 8;
+    }
+    gdb_send(n == REG_COUNT ? "OK" : "E01");
+    break;
+  case 'p':
+    n = gdb_scan(p, &end);
+    if (n >= REG_COUNT) {
+      gdb_send("E01");
+      break;
+    }
+    vmm_call(kVmmGetFloatState, guest->vmm->thread_index);
+    gdb_get_reg(reply, n);
+    gdb_send(reply);
+    break;
+  case 'P':
+    n = gdb_scan(p, &end);
+    gdb_send(n < REG_COUNT && *end == '=' &&
+             gdb_set_reg(n, end + 1) ? "OK" : "E01");
+    break;
+  case 'm':
+    ea = gdb_scan(p, &end);
+    len = *end == ',' ? gdb_scan(end + 1, &end) : 0;
+    len = guest_from_ex(mem, ea, min(len, sizeof(mem) - 1), 1, false);
+    if (len == 0) {
+      gdb_send("E01");
+      break;
+    }
+    gdb_hex(reply, mem, len);
+    gdb_send(reply);
+    break;
+  case 'M':
+    ea = gdb_scan(p, &end);
+    len = *end == ',' ? gdb_scan(end + 1, &end) : 0;
+    if (*end != ':' || len > sizeof(mem) ||
+        gdb_bin(mem, end + 1, len) != len ||
+        guest_to(ea, mem, len, 1) != ERR_NONE) {
+      gdb_send("E01");
+      break;
+    }
+    gdb_send("OK");
+    break;
+  case 'c':
+    return gdb_resume(false, p);
+  case 's':
+    return gdb_resume(true, p);
+  case 'Z':
+    return gdb_bp(p, true);
+  case 'z':
+    return gdb_bp(p, false);
+  case 'v':
+    if (!strncmp(p, "Cont", 4)) {
+      return gdb_vcont(p + 4);
+    }
+    gdb_send("");
+    break;
+  case 'H':
+  case 'T':
+    gdb_send("OK");
+    break;
+  case 'q':
+    if (!strncmp(p, "Supported", 9)) {
+      snprintf(reply, sizeof(pkt), "PacketSize=%x", PKT_SIZE - 1);
+      gdb_send(reply);
+    } else if (!strcmp(p, "Attached")) {
+      gdb_send("1");
+    } else if (!strcmp(p, "C")) {
+      gdb_send("QC1");
+    } else if (!strcmp(p, "fThreadInfo")) {
+      gdb_send("m1");
+    } else if (!strcmp(p, "sThreadInfo")) {
+      gdb_send("l");
+    } else {
+      gdb_send("");
+    }
+    break;
+  case 'D':
+    gdb_send("OK");
+    resumed = false;
+    return ERR_CONTINUE;
+  case 'k':
+    return ERR_SHUTDOWN;
+  default:
+    gdb_send("");
+    break;
+  }
+
+  return ERR_NONE;
+}
+
+/*
+ * Feeds received bytes through the framing, handling
+ * each complete packet.
+ */
+static err_t
+gdb_input(const char *buf, length_t len)
+{
+  err_t err = ERR_NONE;
+
+  for (; len != 0 && err == ERR_NONE; buf++, len--) {
+    char c = *buf;
+
+    switch (pkt_state) {
+    case PKT_IDLE:
+      if (c == '$') {
+        pkt_len = 0;
+        pkt_csum = 0;
+        pkt_state = PKT_DATA;
+      }
+      /*
+       * Acks, and ^C while already stopped.
+       */
+      break;
+    case PKT_DATA:
+      if (c == '#') {
+        pkt_state = PKT_CSUM1;
+      } else if (pkt_len < sizeof(pkt) - 1) {
+        pkt[pkt_len++] = c;
+        pkt_csum += c;
+      }
+      break;
+    case PKT_CSUM1:
+      pkt_their_csum = gdb_unhex(c) << 4;
+      pkt_state = PKT_CSUM2;
+      break;
+    case PKT_CSUM2:
+      pkt_their_csum |= gdb_unhex(c);
+      pkt_state = PKT_IDLE;
+      if (pkt_their_csum != pkt_csum) {
+        socket_out(&s, "-", 1);
+        break;
+      }
+
+      socket_out(&s, "+", 1);
+      pkt[pkt_len] = '\0';
+      err = gdb_handle(pkt);
+      break;
+    }
+  }
+
+  return err;
+}
+
+static void
+gdb_on_connect(socket_t *s,
+               socket_client_t *c)
+{
+  LOG("gdb connected");
+  attach = true;
+  resumed = false;
+  pkt_state = PKT_IDLE;
+}
+
+err_t
+gdb_init(const char *sock_path)
+{
+  s.port = PORT;
+  s.path = sock_path;
+  s.max_clients = 1;
+  s.lossless = true;
+  s.on_connect = gdb_on_connect;
+  return socket_init(&s);
+}
+
+void
+gdb_bye(void)
+{
+  socket_bye(&s);
+}
+
+bool
+gdb_connected(void)
+{
+  return socket_connected(&s);
+}
+
+/*
+ * Called after every exit. A new connection or ^C stops
+ * the guest.
+ */
+err_t
+gdb_check(void)
+{
+  char buf[16];
+  length_t i;
+  length_t len;
+
+  /*
+   * gdb talks right after connecting, so don't
+   * eat that looking for ^C.
+   */
+  socket_handle_connect(&s);
+  if (attach) {
+    attach = false;
+    last_sig = SIGTRAP;
+    return ERR_PAUSE;
+  }
+
+  len = socket_in(&s, buf, sizeof(buf));
+
+  for (i = 0; i < len; i++) {
+    if (buf[i] == 0x03) {
+      last_sig = SIGINT;
+      return ERR_PAUSE;
+    }
+  }
+
+  return ERR_NONE;
+}
+
+err_t
+gdb_activate(err_t why, vmm_return_code_t vmm_ret)
+{
+  err_t err;
+  char buf[PKT_SIZE];
+
+  if (stepping) {
+    stepping = false;
+    guest_set_ss(false);
+  }
+
+  if (why == ERR_BREAKPOINT ||
+      (vmm_ret == kVmmReturnTraceException &&
+       (why == ERR_NONE || why == ERR_PAUSE))) {
+    last_sig = SIGTRAP;
+  } else if (why == ERR_PAUSE) {
+    /*
+     * Set by gdb_check.
+     */
+  } else if (why == ERR_NONE && vmm_ret == kVmmReturnProgramException) {
+    last_sig = SIGILL;
+  } else {
+    if (why != ERR_NONE) {
+      ERROR(why, "stopping for gdb");
+    } else {
+      VMM_ERROR(vmm_ret, "stopping for gdb");
+    }
+    last_sig = why == ERR_UNSUPPORTED ? SIGILL : SIGSEGV;
+  }
+
+  if (resumed) {
+    resumed = false;
+    gdb_stop_reply();
+  }
+
+  while (1) {
+    length_t len;
+
+    if (socket_handle_connect(&s) != ERR_NONE) {
+      LOG("gdb went away, resuming");
+      return ERR_NONE;
+    }
+
+    len = socket_in(&s, buf, sizeof(buf));
+    if (len == 0) {
+      socket_wait_input(&s);
+      continue;
+    }
+
+    err = gdb_input(buf, len);
+    if (err == ERR_CONTINUE) {
+      return ERR_NONE;
+    } else if (err != ERR_NONE) {
+      return err;
+    }
+  }
+}
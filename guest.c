@@ -4,6 +4,9 @@
 #include "vmm.h"
 #include "ppc-defs.h"
 #include "rom.h"
+#include "mmio.h"
+#include "bp.h"
+#include "stats.h"
 
 guest_t *guest = & (guest_t) { 0 };
 
@@ -22,6 +25,9 @@ guest_mon_dump(void)
              guest->vmm == guest->vmm_mmu_on ? "n" : "ff");
   mon_printf("  vmmStat               = 0x%x\n", guest->vmm->vmmStat);
   mon_printf("  vmmCntrl              = 0x%x\n", guest->vmm->vmmCntrl);
+  mon_printf("  exits                 = %llu\n", guest->exits);
+  mon_printf("  own_exits             = %llu\n", guest->own_exits);
+  mon_printf("  exit_pc               = 0x%08x\n", guest->exit_pc);
   mon_printf("  return_code           = 0x%08x (%s)\n",
       guest->vmm->return_code, vmm_return_code_to_string(guest->vmm->return_code));
 
@@ -215,8 +221,27 @@ guest_unmap_all(void)
   vmm_call(kVmmUnmapAllPages, guest->vmm_mmu_on->thread_index);
 }
 
+/*
+ * For mappings made in a context that may no longer
+ * be the current one.
+ */
+void
+guest_unmap_in(vmm_thread_index_t index,
+               gea_t ea)
+{
+  vmm_call(kVmmUnmapPage, index, ea & ~PAGE_MASK);
+}
+
 err_t
 guest_map(ha_t host_address, gea_t ea)
+{
+  return guest_map_prot(host_address, ea, VM_PROT_ALL);
+}
+
+err_t
+guest_map_prot(ha_t host_address,
+               gea_t ea,
+               vm_prot_t prot)
 {
   kern_return_t ret;
 
@@ -224,7 +249,7 @@ guest_map(ha_t host_address, gea_t ea)
   BUG_ON((ea & PAGE_MASK) != 0, "bad alignment");
 
   ret = vmm_call(kVmmMapPage, guest->vmm->thread_index,
-                 host_address, ea, VM_PROT_ALL);
+                 host_address, ea, prot);
 
   ON_MACH_ERROR("kVmmMapPage", ret, out);
  out:
@@ -235,6 +260,25 @@ guest_map(ha_t host_address, gea_t ea)
   return ERR_NONE;
 }
 
+void
+guest_set_timer(guest_timer_t which,
+                uint64_t deadline)
+{
+  unsigned i;
+  uint64_t next = 0;
+
+  guest->timers[which] = deadline;
+  for (i = 0; i < GUEST_TIMERS; i++) {
+    if (guest->timers[i] != 0 &&
+        (next == 0 || guest->timers[i] < next)) {
+      next = guest->timers[i];
+    }
+  }
+
+  vmm_call(kVmmSetTimer, guest->vmm->thread_index,
+           (uint32_t) (next >> 32), (uint32_t) next);
+}
+
 bool
 guest_is_little(void)
 {
@@ -249,6 +293,38 @@ guest_toggle_ss(void)
   return (guest->mon_msr & MSR_SE) != 0;
 }
 
+/*
+ * Returns the previous state.
+ */
+bool
+guest_set_ss(bool on)
+{
+  bool was = (guest->mon_msr & MSR_SE) != 0;
+
+  if (was != on) {
+    guest_toggle_ss();
+  }
+
+  return was;
+}
+
+/*
+ * Changes access to a page in the current context. VM_PROT_NONE
+ * unmaps it. A page that isn't mapped is left alone, as it will
+ * fault in anyway.
+ */
+void
+guest_protect(gea_t ea, vm_prot_t prot)
+{
+  ea &= ~PAGE_MASK;
+
+  if (prot == VM_PROT_NONE) {
+    vmm_call(kVmmUnmapPage, guest->vmm->thread_index, ea);
+  } else {
+    vmm_call(kVmmProtectPage, guest->vmm->thread_index, ea, prot);
+  }
+}
+
 length_t
 guest_from_ex(void *dest,
               gea_t src,
@@ -385,7 +461,7 @@ guest_backmap_ex(gea_t ea, gra_t *gra,
   gea_t offset = ea & PAGE_MASK;
 
   if ((guest->msr & MSR_MMU_ON) != MSR_MMU_ON) {
-    if (pmem_gra_valid(ea)) {
+    if (pmem_gra_valid(ea) || mmio_page(ea)) {
       *gra = ea;
       return ERR_NONE;
     }
@@ -401,8 +477,8 @@ guest_backmap_ex(gea_t ea, gra_t *gra,
      */
     ha_base = vmm_call(kVmmGetPageMapping,
                        guest->vmm->thread_index, ea);
-    if (ha_base != (ha_t) -1) {
-      pmem_gra(ha_base + offset, gra);
+    if (ha_base != (ha_t) -1 &&
+        pmem_gra(ha_base + offset, gra) == ERR_NONE) {
       return ERR_NONE;
     }
   }
@@ -426,6 +502,167 @@ guest_backmap(gea_t ea, gra_t *gra)
   return guest_backmap_ex(ea, gra, true, 0);
 }
 
+/*
+ * Decodes the load or store that faulted on a page backed by
+ * an emulated device. Only the integer byte, halfword and word
+ * forms (including update, indexed and byte-reversed) make
+ * sense for device registers.
+ */
+static err_t
+guest_mmio(gea_t page_ea,
+           gra_t page_ra)
+{
+  err_t err;
+  uint32_t insn;
+  unsigned rs;
+  unsigned ra;
+  unsigned rb;
+  gea_t ea;
+  uint32_t val;
+  length_t size;
+  bool store;
+  bool update = false;
+  bool sign = false;
+  bool brx = false;
+
+  err = guest_from_x(&insn, guest->regs->ppcPC);
+  ON_ERROR("read insn", err, done);
+
+#define R(x) guest->regs->ppcGPRs[x]
+
+  rs = PPC_MASK_OUT(insn, 6, 10);
+  ra = PPC_MASK_OUT(insn, 11, 15);
+  rb = PPC_MASK_OUT(insn, 16, 20);
+
+  switch (insn >> 26) {
+  case 32: /* lwz */
+  case 33: /* lwzu */
+  case 34: /* lbz */
+  case 35: /* lbzu */
+  case 36: /* stw */
+  case 37: /* stwu */
+  case 38: /* stb */
+  case 39: /* stbu */
+  case 40: /* lhz */
+  case 41: /* lhzu */
+  case 42: /* lha */
+  case 43: /* lhau */
+  case 44: /* sth */
+  case 45: /* sthu */ {
+    unsigned op = insn >> 26;
+
+    ea = (ra != 0 ? R(ra) : 0) + (int16_t) (insn & 0xffff);
+    update = (op & 1) != 0;
+    store = op == 36 || op == 37 || op == 38 || op == 39 ||
+      op == 44 || op == 45;
+    sign = op == 42 || op == 43;
+    size = op < 34 || op == 36 || op == 37 ? 4 :
+      op < 40 ? 1 : 2;
+    break;
+  }
+  case 31:
+    ea = (ra != 0 ? R(ra) : 0) + R(rb);
+    switch (PPC_MASK_OUT(insn, 21, 30)) {
+    case 23:  /* lwzx */
+    case 55:  /* lwzux */
+    case 151: /* stwx */
+    case 183: /* stwux */
+    case 534: /* lwbrx */
+    case 662: /* stwbrx */
+      size = 4;
+      break;
+    case 87:  /* lbzx */
+    case 119: /* lbzux */
+    case 215: /* stbx */
+    case 247: /* stbux */
+      size = 1;
+      break;
+    case 279: /* lhzx */
+    case 311: /* lhzux */
+    case 343: /* lhax */
+    case 375: /* lhaux */
+    case 407: /* sthx */
+    case 439: /* sthux */
+    case 790: /* lhbrx */
+    case 918: /* sthbrx */
+      size = 2;
+      break;
+    default:
+      goto unsupported;
+    }
+
+    switch (PPC_MASK_OUT(insn, 21, 30)) {
+    case 534:
+    case 662:
+    case 790:
+    case 918:
+      brx = true;
+      break;
+    default:
+      update = (PPC_MASK_OUT(insn, 21, 30) & 0x20) != 0;
+      break;
+    }
+    store = (PPC_MASK_OUT(insn, 21, 30) & 0x80) != 0;
+    sign = PPC_MASK_OUT(insn, 21, 30) == 343 ||
+      PPC_MASK_OUT(insn, 21, 30) == 375;
+    break;
+  default:
+    goto unsupported;
+  }
+
+  if ((ea & ~PAGE_MASK) != page_ea ||
+      ((ea + size - 1) & ~PAGE_MASK) != page_ea) {
+    ERROR(ERR_UNSUPPORTED, "0x%x: device access to 0x%x crosses page 0x%x",
+          guest->regs->ppcPC, ea, page_ea);
+    return ERR_UNSUPPORTED;
+  }
+
+  /*
+   * Devices sit on little-endian buses, so a big-endian
+   * guest sees them byte-swapped unless using the
+   * byte-reversed forms.
+   */
+  if (store) {
+    val = R(rs);
+    if (!guest_is_little() != brx) {
+      val = size == 4 ? le32_to_cpu(val) : size == 2 ?
+        le16_to_cpu((uint16_t) val) : val;
+    }
+    err = mmio_write(page_ra + (ea & PAGE_MASK), size,
+                     val & (0xffffffff >> (32 - size * 8)));
+  } else {
+    err = mmio_read(page_ra + (ea & PAGE_MASK), size, &val);
+    if (!guest_is_little() != brx) {
+      val = size == 4 ? le32_to_cpu(val) : size == 2 ?
+        le16_to_cpu((uint16_t) val) : val;
+    }
+    if (sign) {
+      val = (int16_t) val;
+    }
+    R(rs) = val;
+  }
+
+  if (err != ERR_NONE) {
+    ERROR(err, "0x%x: device %s 0x%x", guest->regs->ppcPC,
+          store ? "store to" : "load from", ea);
+    return err;
+  }
+
+  if (update) {
+    R(ra) = ea;
+  }
+
+  guest->regs->ppcPC += 4;
+ done:
+  return err;
+
+ unsupported:
+  ERROR(ERR_UNSUPPORTED, "0x%x: unsupported device access insn 0x%08x",
+        guest->regs->ppcPC, insn);
+  return ERR_UNSUPPORTED;
+#undef R
+}
+
 err_t
 guest_fault(bool isi)
 {
@@ -439,6 +676,27 @@ guest_fault(bool isi)
   gea = return_params32[0] & ~PAGE_MASK;
   dsisr = return_params32[1];
 
+  err = bp_fault(return_params32[0], (dsisr & DSISR_STORE) != 0, isi);
+  if (err == ERR_CONTINUE) {
+    /*
+     * Watched page, map it in for one step.
+     */
+    dsisr = (dsisr & ~DSISR_BAD_PERM) | DSISR_NOT_PRESENT;
+  } else if (err != ERR_NOT_FOUND) {
+    return err;
+  }
+
+  /*
+   * A store to a device page mapped read-only, see
+   * mmio_shadow_map.
+   */
+  if (!isi && (dsisr & (DSISR_BAD_PERM | DSISR_STORE)) ==
+      (DSISR_BAD_PERM | DSISR_STORE) &&
+      guest_backmap_ex(gea, &gra, false, GUEST_FAULT_ON_STORE) == ERR_NONE &&
+      !pmem_gra_valid(gra)) {
+    return guest_mmio(gea, gra);
+  }
+
   /*
    * A permission fault needs to be handled by being fowarded
    * to the guest.
@@ -469,6 +727,22 @@ guest_fault(bool isi)
       return err;
     }
 
+    if (!pmem_gra_valid(gra)) {
+      /*
+       * Nothing to execute in a device page.
+       */
+      if (isi) {
+        ERROR(ERR_BAD_ACCESS, "instruction fetch from device at 0x%x", gea);
+        return ERR_BAD_ACCESS;
+      }
+
+      if ((dsisr & DSISR_STORE) == 0 && mmio_shadow_map(gea, gra)) {
+        return ERR_NONE;
+      }
+
+      return guest_mmio(gea, gra);
+    }
+
     err = guest_map(pmem_ha(gra), gea);
     if (err != ERR_NONE) {
       ERROR(err, "guest_map");
@@ -481,8 +755,8 @@ guest_fault(bool isi)
   return ERR_UNSUPPORTED;
 }
 
-err_t
-guest_emulate(void)
+static err_t
+guest_emulate_insn(const char **op)
 {
   err_t err;
   uint32_t insn;
@@ -514,6 +788,7 @@ guest_emulate(void)
       guest_to_x(R(10), &guest->sprg[0]);
       guest->regs->ppcPC += 10 * sizeof(uint32_t);
       VERBOSE("skipped lock seq 1");
+      *op = "lock seq 1";
       return ERR_NONE;
     }
   } else if (insn == 0x7cb042a6) {
@@ -528,6 +803,7 @@ guest_emulate(void)
       guest_to_x(R(3), &guest->sprg[0]);
       guest->regs->ppcPC += 5 * sizeof(uint32_t);
       VERBOSE("skipped lock seq 2");
+      *op = "lock seq 2";
       return ERR_NONE;
     }
   } else if (insn == 0x7cf042a6) {
@@ -542,6 +818,7 @@ guest_emulate(void)
       guest_to_x(R(9), &guest->sprg[0]);
       guest->regs->ppcPC += 5 * sizeof(uint32_t);
       VERBOSE("skipped lock seq 3/4");
+      *op = "lock seq 3/4";
       return ERR_NONE;
     }
   }
@@ -550,6 +827,8 @@ guest_emulate(void)
     uint32_t nexti = 0;
     int reg = PPC_MASK_OUT(insn, 16, 20);
     gea_t ea = R(reg);
+
+    *op = "tlbie";
     /*
      * Valid for NT, heh.
      *
@@ -565,14 +844,17 @@ guest_emulate(void)
   } if ((insn & INST_MFSR_MASK) == INST_MFSR) {
     int reg = PPC_MASK_OUT(insn, 6, 10);
     int sr = PPC_MASK_OUT(insn, 12, 15);
+    *op = "mfsr";
     R(reg) = guest->sr[sr];
     err = ERR_NONE;
   } else if ((insn & INST_MTSR_MASK) == INST_MTSR) {
     int reg = PPC_MASK_OUT(insn, 6, 10);
     int sr = PPC_MASK_OUT(insn, 12, 15);
+    *op = "mtsr";
     guest->sr[sr] = R(reg);
     err = ERR_NONE;
   } else if ((insn & INST_RFI_MASK) == INST_RFI) {
+    *op = "rfi";
     update_insn = false;
     guest_set_msr(guest->srr1);
     guest->regs->ppcPC = guest->srr0;
@@ -581,6 +863,7 @@ guest_emulate(void)
     int reg = PPC_MASK_OUT(insn, 6, 10);
     int spr = PPC_MASK_OUT(insn, 11, 20);
     spr = ((spr & 0x1f) << 5) | ((spr & 0x3e0) >> 5);
+    *op = "mfspr";
     switch (spr) {
     case SPRN_PVR:
       R(reg) = guest->pvr;
@@ -643,6 +926,7 @@ guest_emulate(void)
     int reg = PPC_MASK_OUT(insn, 6, 10);
     int spr = PPC_MASK_OUT(insn, 11, 20);
     spr = ((spr & 0x1f) << 5) | ((spr & 0x3e0) >> 5);
+    *op = "mtspr";
     switch (spr) {
     case SPRN_SRR0:
       guest->srr0 = R(reg);
@@ -693,10 +977,12 @@ guest_emulate(void)
     }
   } else if ((insn & INST_MFMSR_MASK) == INST_MFMSR) {
     int reg = PPC_MASK_OUT(insn, 6, 10);
+    *op = "mfmsr";
     R(reg) = guest->msr;
     err = ERR_NONE;
   } else if ((insn & INST_MTMSR_MASK) == INST_MTMSR) {
     int reg = PPC_MASK_OUT(insn, 6, 10);
+    *op = "mtmsr";
     guest_set_msr(R(reg));
     err = ERR_NONE;
   }
@@ -712,3 +998,15 @@ guest_emulate(void)
   }
   return err;
 }
+
+err_t
+guest_emulate(void)
+{
+  err_t err;
+  const char *op = "unhandled";
+  uint64_t start = hist_time_ns();
+
+  err = guest_emulate_insn(&op);
+  stats_emul(op, start);
+  return err;
+}
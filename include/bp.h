@@ -0,0 +1,22 @@
+#pragma once
+#include "pvp.h"
+
+/*
+ * Breakpoints patch a trap into guest memory and are keyed by
+ * the guest real address, so they follow the code rather than
+ * whatever happens to map it. Watchpoints write-protect (or for
+ * any access, unmap) the page in the current context and filter
+ * the faults. Either way, getting past a hit means putting the
+ * page or instruction back for a single step.
+ */
+#define BP_TRAP 0x7fe00008 /* tw 31,0,0 */
+
+err_t bp_add(gea_t ea);
+err_t bp_del(gea_t ea);
+err_t wp_add(gea_t ea, length_t len, bool write);
+err_t wp_del(gea_t ea);
+err_t bp_program(void);
+err_t bp_fault(gea_t dar, bool store, bool isi);
+bool bp_trace(void);
+void bp_resume(void);
+void bp_mon_dump(void);
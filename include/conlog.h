@@ -0,0 +1,37 @@
+#pragma once
+#include "pvp.h"
+
+/*
+ * On-disk layout of the console capture file. data_size bytes
+ * of output follow the header as a ring, and byte N of the
+ * stream (counting from the very first run) lives at
+ * data[N % data_size]. Only the last data_size bytes of
+ * the stream survive.
+ *
+ * The index has one entry per data_size / CONLOG_INDEX
+ * bytes of ring, giving the stream offset and wall clock
+ * time at which that slice was last started.
+ */
+#define CONLOG_MAGIC   0x5056434cU /* PVCL */
+#define CONLOG_VERSION 1
+#define CONLOG_INDEX   256
+
+typedef struct conlog_mark_s {
+  uint64_t off;
+  uint64_t time_ns;
+} conlog_mark_t;
+
+typedef struct conlog_hdr_s {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t hdr_size;
+  uint32_t data_size;
+  uint64_t written;
+  conlog_mark_t index[CONLOG_INDEX];
+} conlog_hdr_t;
+
+err_t conlog_init(const char *path, length_t size);
+void conlog_add(const char *buf, length_t len);
+void conlog_tail(count_t lines);
+count_t conlog_find(const char *pattern, count_t max);
+void conlog_bye(void);
@@ -84,5 +84,18 @@ swab16(uint16_t value)
    return result;
 }
 
+static inline uint64_t
+swab64(uint64_t value)
+{
+  return ((uint64_t) swab32(value) << 32) | swab32(value >> 32);
+}
+
+#define le64_to_cpu(X) swab64(X)
 #define le32_to_cpu(X) swab32(X)
 #define le16_to_cpu(X) swab16(X)
+
+/*
+ * Host is big-endian.
+ */
+#define be32_to_cpu(X) (X)
+#define be16_to_cpu(X) (X)
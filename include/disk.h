@@ -7,16 +7,59 @@
 
 typedef struct disk_s disk_t;
 
+/*
+ * Kept per disk and per open ihandle. An access is
+ * sequential if it starts where the previous one ended.
+ */
+typedef struct disk_io_stats_s {
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+  uint64_t seeks;
+  uint64_t seq;
+  uint64_t random;
+  uint64_t next_off;
+} disk_io_stats_t;
+
+static inline void
+disk_io_account(disk_io_stats_t *s,
+                bool write,
+                uint64_t off,
+                length_t len)
+{
+  if (write) {
+    s->writes++;
+    s->write_bytes += len;
+  } else {
+    s->reads++;
+    s->read_bytes += len;
+  }
+
+  if (off == s->next_off) {
+    s->seq++;
+  } else {
+    s->random++;
+  }
+  s->next_off = off + len;
+}
+
 typedef struct disk_part_s {
   offset_t off;
   length_t length;
 } disk_part_t;
 
-disk_t *disk_open(const char *disk_path);
+disk_t *disk_open(const char *disk_path, bool read_only);
 void disk_close(disk_t *disk);
 void disk_bye();
 err_t disk_seek(disk_t *d, offset_t offset);
 length_t disk_out(disk_t *d, const uint8_t *buf, length_t len);
 length_t disk_in(disk_t *d, uint8_t *buf, length_t expected);
+uint64_t disk_gen(disk_t *d);
+const uint8_t *disk_map_at(disk_t *d, offset_t offset, length_t *len);
+err_t disk_read_at(disk_t *d, uint64_t offset, uint8_t *buf, length_t len);
+int disk_io_stats_format(disk_io_stats_t *s, char *buf, length_t size);
+void disk_mon_dump(void);
+void disk_io_totals(disk_io_stats_t *total);
 err_t disk_find_part(disk_t *disk, unsigned index,
                      disk_part_t *part);
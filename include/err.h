@@ -17,6 +17,7 @@
   ERR_DEF(ERR_PAUSE, "Pause VM execution")                            \
   ERR_DEF(ERR_POSIX, "POSIX error")                                   \
   ERR_DEF(ERR_NOT_ROM_CALL, "Not a ROM call")                         \
+  ERR_DEF(ERR_BREAKPOINT, "Breakpoint hit")                           \
   ERR_DEF(ERR_INVALID, "invalid error, likely a bug") /* last */
 
 #define ERR_DEF(e, s) e,
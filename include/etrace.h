@@ -0,0 +1,83 @@
+#pragma once
+#include "pvp.h"
+#include "vmm.h"
+
+/*
+ * On-disk layout of the exit trace file. entries records (a
+ * power of two) follow the header as a ring, and record N
+ * (counting from the start of the run) lives at
+ * records[N % entries]. Times are host ns since start_ns.
+ *
+ * dar and dsisr are the first two vmm return parameters,
+ * which is what they hold for page faults. cif is the id of
+ * the CIF service called, with names in the header, or 0.
+ */
+#define ETRACE_MAGIC    0x50564554U /* PVET */
+#define ETRACE_VERSION  1
+#define ETRACE_CIFS     32
+#define ETRACE_NAME_LEN 32
+
+typedef struct etrace_rec_s {
+  uint64_t time_ns;
+  uint32_t code;
+  uint32_t pc;
+  uint32_t lr;
+  uint32_t dar;
+  uint32_t dsisr;
+  uint32_t cif;
+} etrace_rec_t;
+
+typedef struct etrace_hdr_s {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t hdr_size;
+  uint32_t entries;
+  uint64_t written;
+  uint64_t start_ns;
+  char cif[ETRACE_CIFS][ETRACE_NAME_LEN];
+} etrace_hdr_t;
+
+err_t etrace_init(const char *path, count_t entries);
+void etrace_exit(vmm_return_code_t code, uint64_t time_ns);
+void etrace_tail(count_t count);
+void etrace_bye(void);
+
+/*
+ * Shared with etdump, which decodes trace files offline.
+ */
+static inline int
+etrace_format(etrace_hdr_t *hdr,
+              uint64_t index,
+              char *buf,
+              length_t size)
+{
+  int len;
+  const char *name;
+  etrace_rec_t *r = (etrace_rec_t *) ((char *) hdr + hdr->hdr_size) +
+    index % hdr->entries;
+
+#define _VMM_RETURN_CODE(x) case x: name = #x + 4; break;
+  switch (r->code) {
+    VMM_RETURN_CODES
+  default:
+    name = "unknown";
+  }
+#undef _VMM_RETURN_CODE
+
+  len = snprintf(buf, size, "%8llu %8llu.%03llu %-22s pc 0x%08x lr 0x%08x",
+                 index, r->time_ns / 1000, r->time_ns % 1000, name,
+                 r->pc, r->lr);
+
+  if (r->code == kVmmReturnDataPageFault ||
+      r->code == kVmmReturnInstrPageFault) {
+    len += snprintf(buf + len, size - len, " dar 0x%08x dsisr 0x%08x",
+                    r->dar, r->dsisr);
+  }
+
+  if (r->cif != 0 && r->cif <= ETRACE_CIFS) {
+    len += snprintf(buf + len, size - len, " cif %.*s", ETRACE_NAME_LEN,
+                    hdr->cif[r->cif - 1]);
+  }
+
+  return len;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "pvp.h"
+#include "disk.h"
+
+typedef struct fs_s fs_t;
+typedef struct fs_file_s fs_file_t;
+
+fs_t *fs_mount(disk_t *disk, disk_part_t *part);
+const char *fs_name(fs_t *fs);
+err_t fs_open(fs_t *fs, const char *path, fs_file_t **file);
+void fs_close(fs_file_t *file);
+length_t fs_size(fs_file_t *file);
+length_t fs_read(fs_file_t *file, offset_t off, uint8_t *buf,
+                 length_t len);
+const uint8_t *fs_map_at(fs_file_t *file, offset_t off, length_t *len);
+void fs_bye(void);
@@ -0,0 +1,9 @@
+#pragma once
+#include "pvp.h"
+#include "vmm.h"
+
+err_t gdb_init(const char *sock_path);
+void gdb_bye(void);
+bool gdb_connected(void);
+err_t gdb_check(void);
+err_t gdb_activate(err_t why, vmm_return_code_t vmm_ret);
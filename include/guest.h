@@ -4,6 +4,17 @@
 #include "vmm.h"
 #include "mon.h"
 
+/*
+ * Users of the VMM timer. Each keeps its own deadline, in
+ * mach_absolute_time() units or 0 for none, and the earliest
+ * one is armed.
+ */
+typedef enum {
+  GUEST_TIMER_PROF,
+  GUEST_TIMER_UART,
+  GUEST_TIMERS,
+} guest_timer_t;
+
 typedef struct guest_t {
 #define SDR1_MAGIC_ROM_MODE (-1)
   uint32_t sdr1;
@@ -26,6 +37,23 @@ typedef struct guest_t {
   vmm_state_page_t *vmm_mmu_on;
   vmm_state_page_t *vmm_mmu_off;
   vmm_regs32_t *regs;
+  /*
+   * Returns from kVmmExecuteVM, including timer pops
+   * (kVmmReturnNull) forced by GUEST_TIMER_*.
+   */
+  uint64_t exits;
+  /*
+   * Exits the guest caused itself, leaving out timer pops.
+   * With the UART kept trapped (see term_recording), this is
+   * deterministic for a given guest and input, so it doubles
+   * as the clock for input record and replay.
+   */
+  uint64_t own_exits;
+  /*
+   * PC the guest exited at, before any emulation moved it.
+   */
+  gea_t exit_pc;
+  uint64_t timers[GUEST_TIMERS];
 } guest_t;
 
 extern guest_t *guest;
@@ -35,6 +63,9 @@ err_t guest_init(bool little, length_t ram_size);
 void guest_bye(void);
 bool guest_is_little(void);
 err_t guest_map(ha_t host_address, gea_t ea);
+err_t guest_map_prot(ha_t host_address, gea_t ea, vm_prot_t prot);
+void guest_unmap_in(vmm_thread_index_t index, gea_t ea);
+void guest_set_timer(guest_timer_t which, uint64_t deadline);
 err_t guest_backmap(gea_t ea, gra_t *gra);
 err_t guest_from(void *dest, gea_t src, length_t bytes,
                  length_t access_size);
@@ -43,6 +74,8 @@ length_t guest_from_ex(void *dest, gea_t src, length_t bytes,
 err_t guest_to(gra_t dest, const void *src, length_t bytes,
                length_t access_size);
 bool guest_toggle_ss(void);
+bool guest_set_ss(bool on);
+void guest_protect(gea_t ea, vm_prot_t prot);
 err_t guest_emulate(void);
 err_t guest_fault(bool isi);
 
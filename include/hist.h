@@ -0,0 +1,29 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Log-linear (HDR-style) histogram: every power of two is
+ * split into HIST_SUB linear buckets, so any recorded value
+ * is known to within 1/HIST_SUB of itself, at a fixed cost
+ * no matter how wide the range. Values past 2^HIST_MAX_BITS
+ * land in the last bucket.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1U << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS  ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct hist_s {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+void hist_init(hist_t *h);
+void hist_record(hist_t *h, uint64_t value);
+uint64_t hist_percentile(hist_t *h, unsigned permille);
+int hist_format(hist_t *h, const char *unit, char *buf, length_t size);
+uint64_t hist_time_ns(void);
@@ -0,0 +1,20 @@
+#pragma once
+#include "pvp.h"
+
+/*
+ * Callbacks run on the I/O thread whenever fd is readable
+ * (or writable, for write watches).
+ */
+typedef struct io_watch_s {
+  int fd;
+  bool write;
+  void (*cb)(struct io_watch_s *w);
+  void *arg;
+} io_watch_t;
+
+err_t io_init(void);
+err_t io_watch(io_watch_t *w);
+void io_unwatch(io_watch_t *w);
+void io_enable(io_watch_t *w, bool enable);
+bool io_running(void);
+void io_bye(void);
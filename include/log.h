@@ -32,6 +32,7 @@ void _log(unsigned level, unsigned log_lvl, unsigned error_extra,
 
 #define FATAL(error, fmt, ...)       _LOG(LOG_FATAL, error, fmt, ## __VA_ARGS__)
 #define ERROR(error, fmt, ...)       _LOG(LOG_ERROR, error, fmt, ## __VA_ARGS__)
+#define FDT_ERROR(error, fmt, ...)   _LOG(LOG_FDT_ERROR, error, fmt, ## __VA_ARGS__)
 #define MACH_ERROR(error, fmt, ...)  _LOG(LOG_MACH_ERROR, error, fmt, ## __VA_ARGS__)
 #define POSIX_ERROR(error, fmt, ...) _LOG(LOG_POSIX_ERROR, error, fmt, ## __VA_ARGS__)
 #define VMM_ERROR(error, fmt, ...)   _LOG(LOG_VMM_ERROR, error, fmt, ## __VA_ARGS__)
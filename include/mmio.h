@@ -0,0 +1,55 @@
+#pragma once
+#include "pvp.h"
+#include "vmm.h"
+#include "list.h"
+
+#define MMIO_SHADOW_MAPS 4
+
+/*
+ * Emulated devices claim ranges of guest physical addresses
+ * that aren't RAM. Pages containing a claimed range are never
+ * mapped, so every access faults and is decoded by guest_fault.
+ * Handlers see the value as the device would, i.e. any byte
+ * swapping for a big-endian guest has already been done.
+ */
+typedef struct mmio_range_s {
+  struct list_head link;
+  const char *name;
+  gra_t base;
+  length_t size;
+  err_t (*read)(struct mmio_range_s *m, offset_t off,
+                length_t size, uint32_t *val);
+  err_t (*write)(struct mmio_range_s *m, offset_t off,
+                 length_t size, uint32_t val);
+  /*
+   * Called on the first exit that isn't a device access,
+   * so devices can batch side effects.
+   */
+  void (*sync)(struct mmio_range_s *m);
+  /*
+   * Optional. Returns a host page holding what the guest
+   * would read from the device's page, or NULL if reads
+   * have side effects right now. It gets mapped read-only,
+   * so loads stop exiting and only stores fault. The device
+   * keeps it current and calls mmio_shadow_revoke() once
+   * reads matter again.
+   */
+  uint8_t *(*shadow)(struct mmio_range_s *m);
+  void *arg;
+  uint64_t reads;
+  uint64_t writes;
+  unsigned shadow_maps;
+  struct {
+    vmm_thread_index_t index;
+    gea_t ea;
+  } shadow_map[MMIO_SHADOW_MAPS];
+} mmio_range_t;
+
+void mmio_add(mmio_range_t *m);
+bool mmio_page(gra_t ra);
+err_t mmio_read(gra_t ra, length_t size, uint32_t *val);
+err_t mmio_write(gra_t ra, length_t size, uint32_t val);
+void mmio_sync(void);
+bool mmio_shadow_map(gea_t ea, gra_t ra);
+void mmio_shadow_revoke(mmio_range_t *m);
+void mmio_mon_dump(void);
@@ -2,7 +2,7 @@
 
 #include "pvp.h"
 
-err_t mon_init(void);
+err_t mon_init(const char *sock_path);
 void mon_bye(void);
 err_t mon_activate(void);
 err_t mon_check(void);
@@ -299,6 +299,7 @@ typedef struct picolParser {
 
 typedef struct picolVar {
     struct picolVar* next;
+    struct picolVar* hnext; /* callframe hash chain */
     char*  name;
     char*  val;
 } picolVar;
@@ -314,6 +315,7 @@ typedef picolResult (*picolFunc)(
 
 typedef struct picolCmd {
     struct picolCmd*      next;
+    struct picolCmd*      hnext; /* interp hash chain */
     char*                 name;
     picolFunc             func;
     unsigned char         isproc; /* is this command a procedure? */
@@ -322,8 +324,12 @@ typedef struct picolCmd {
     void*                 privdata;
 } picolCmd;
 
+#define PICOL_VAR_BUCKETS 16
+#define PICOL_CMD_BUCKETS 128
+
 typedef struct picolCallFrame {
     picolVar*              vars;
+    picolVar*              table[PICOL_VAR_BUCKETS];
     char*                  command;
     struct picolCallFrame* parent; /* parent is NULL at top level */
 } picolCallFrame;
@@ -345,6 +351,7 @@ typedef struct picolInterp {
     int             maxlevel;
     picolCallFrame* callframe;
     picolCmd*       commands;
+    picolCmd*       cmdtable[PICOL_CMD_BUCKETS];
     char*           current;    /* currently executed command */
     char*           result;
     int             debug;      /* 1 to display each command, 0 not to */
@@ -461,7 +468,6 @@ PICOL_COMMAND(while);
     picolVar*   picolArrSetByName(picolInterp *interp, const char *name,
                                   const char *value);
     char*       picolArrStat(picolArray *ap, char* buf, size_t buf_size);
-    int         picolHash(const char* key, int modulo);
 #endif
 #if PICOL_FEATURE_GLOB
     PICOL_COMMAND(glob);
@@ -546,9 +552,12 @@ int picolStrCompare(const char* a, const char* b, size_t len, int nocase);
 picolResult picolUnsetVar(picolInterp* interp, const char* name);
 picolBool picolWildEq(const char* pat, const char* str, int n);
 picolCmd *picolGetCmd(picolInterp *interp, const char *name);
+void picolHashCmd(picolInterp *interp, picolCmd *c, int add);
 picolInterp* picolCreateInterp(void);
 picolInterp* picolCreateInterp2(int register_core_cmds, int randomize);
 picolVar *picolGetVar2(picolInterp *interp, const char *name, int global);
+picolVar *picolFindVar(picolCallFrame *cf, const char *name);
+int picolHash(const char* key, int modulo);
 void picolDropCallFrame(picolInterp *interp);
 void picolEscape(char *str, size_t str_size);
 void picolFreeCmd(picolCmd *cmd);
@@ -875,15 +884,31 @@ picolResult picolErrFmt(
 
     return picolErr(interp, buf);
 }
+int picolHash(const char* key, int modulo) {
+    const char* cp;
+    unsigned int hash = 0;
+    for (cp = key; *cp; cp++) {
+        hash = (hash << 1) ^ *cp;
+    }
+    return (int)(hash % modulo);
+}
+picolVar* picolFindVar(picolCallFrame* cf, const char* name) {
+    picolVar* v = cf->table[picolHash(name, PICOL_VAR_BUCKETS)];
+    for (; v != NULL; v = v->hnext) {
+        if (PICOL_EQ(v->name, name)) {
+            return v;
+        }
+    }
+    return NULL;
+}
 picolVar* picolGetVar2(picolInterp* interp, const char* name, int global) {
-    picolVar* v = interp->callframe->vars;
+    picolVar* v;
+    picolCallFrame* c = interp->callframe;
     int coloned = PICOL_COLONED(name);
     if (coloned || global) {
-        picolCallFrame* c = interp->callframe;
         while (c->parent) {
             c = c->parent;
         }
-        v = c->vars;
         if (coloned) {
             name += 2; /* skip the "::" */
         }
@@ -894,16 +919,10 @@ picolVar* picolGetVar2(picolInterp* interp, const char* name, int global) {
         /* Array element syntax? */
         if ((cp = strchr(name, '('))) {
             picolArray* ap;
-            int found = 0;
             strncpy(buf, name, cp - name);
             buf[cp - name] = '\0';
-            for (; v != NULL; v = v->next) {
-                if (PICOL_EQ(v->name, buf)) {
-                    found = 1;
-                    break;
-                }
-            }
-            if (!found) {
+            v = picolFindVar(c, buf);
+            if (v == NULL) {
                 return NULL;
             }
             ap = picolScanPtr(v->val);
@@ -939,12 +958,7 @@ picolVar* picolGetVar2(picolInterp* interp, const char* name, int global) {
         }
     }
 #endif /* PICOL_FEATURE_ARRAYS */
-    for (; v != NULL; v = v->next) {
-        if (PICOL_EQ(v->name, name)) {
-            return v;
-        }
-    }
-    return NULL;
+    return picolFindVar(c, name);
 }
 picolResult picolSetVar2(
     picolInterp* interp,
@@ -986,10 +1000,12 @@ picolResult picolSetVar2(
                 c = c->parent;
             }
         }
-        v       = PICOL_MALLOC(sizeof(*v));
-        v->name = strdup(name);
-        v->next = c->vars;
-        c->vars = v;
+        v        = PICOL_MALLOC(sizeof(*v));
+        v->name  = strdup(name);
+        v->next  = c->vars;
+        c->vars  = v;
+        v->hnext = c->table[picolHash(name, PICOL_VAR_BUCKETS)];
+        c->table[picolHash(name, PICOL_VAR_BUCKETS)] = v;
         interp->callframe = localc;
     }
     v->val = (val == NULL ? NULL : strdup(val));
@@ -1051,12 +1067,14 @@ void picolInitInterp(picolInterp* interp) {
     interp->maxlevel  = PICOL_MAX_LEVEL;
     interp->callframe = PICOL_MALLOC(sizeof(picolCallFrame));
     interp->commands  = NULL;
+    memset(interp->cmdtable, 0, sizeof(interp->cmdtable));
     interp->current   = NULL;
     interp->result    = strdup("");
     interp->debug     = 0;
     interp->validptrs = NULL;
 
     interp->callframe->vars = NULL;
+    memset(interp->callframe->table, 0, sizeof(interp->callframe->table));
     interp->callframe->command = NULL;
     interp->callframe->parent = NULL;
 
@@ -1080,12 +1098,24 @@ void picolFreeCmd(picolCmd* cmd) {
     PICOL_FREE(cmd);
 }
 picolCmd* picolGetCmd(picolInterp* interp, const char* name) {
-    picolCmd* c;
-    for (c = interp->commands; c; c = c->next) {
+    picolCmd* c = interp->cmdtable[picolHash(name, PICOL_CMD_BUCKETS)];
+    for (; c; c = c->hnext) {
         if (PICOL_EQ(c->name, name)) return c;
     }
     return NULL;
 }
+void picolHashCmd(picolInterp* interp, picolCmd* c, int add) {
+    picolCmd** cp = &interp->cmdtable[picolHash(c->name, PICOL_CMD_BUCKETS)];
+    if (add) {
+        c->hnext = *cp;
+        *cp = c;
+        return;
+    }
+    while (*cp != c) {
+        cp = &(*cp)->hnext;
+    }
+    *cp = c->hnext;
+}
 picolResult picolRegisterCmd(
     picolInterp* interp,
     const char* name,
@@ -1103,6 +1133,7 @@ picolResult picolRegisterCmd(
     c->isproc   = f == &picolCallProc;
     c->privdata = pd;
     interp->commands = c;
+    picolHashCmd(interp, c, 1);
     return PICOL_OK;
 }
 picolResult picolRenameCmd(
@@ -1117,6 +1148,7 @@ picolResult picolRenameCmd(
 
     for (c = interp->commands; c; last = c, c=c->next) {
         if (PICOL_EQ(c->name, from)) {
+            picolHashCmd(interp, c, 0);
             if (last == NULL && deleting) {
                 /* Delete the first command. */
                 interp->commands = c->next;
@@ -1129,6 +1161,7 @@ picolResult picolRenameCmd(
                 /* Rename a command.  We only free() the name. */
                 PICOL_FREE(c->name);
                 c->name = strdup(to);
+                picolHashCmd(interp, c, 1);
             }
             found = 1;
             break;
@@ -1810,6 +1843,7 @@ picolResult picolCallProc(
     }
 
     cf->vars = NULL;
+    memset(cf->table, 0, sizeof(cf->table));
     cf->command = NULL;
     cf->parent = interp->callframe;
     interp->callframe = cf;
@@ -1913,6 +1947,11 @@ picolResult picolUnsetVar(picolInterp* interp, const char* name) {
 
     for (v = cf->vars; v != NULL; lastv = v, v = v->next) {
         if (PICOL_EQ(v->name, name)) {
+            picolVar** vp = &cf->table[picolHash(name, PICOL_VAR_BUCKETS)];
+            while (*vp != v) {
+                vp = &(*vp)->hnext;
+            }
+            *vp = v->hnext;
             found = 1;
             if (lastv == NULL) {
                 cf->vars = v->next;
@@ -2305,14 +2344,6 @@ PICOL_COMMAND(apply) {
 }
 /* -------------------------------------------------------------- Array stuff */
 #if PICOL_FEATURE_ARRAYS
-int picolHash(const char* key, int modulo) {
-    const char* cp;
-    unsigned int hash = 0;
-    for (cp = key; *cp; cp++) {
-        hash = (hash << 1) ^ *cp;
-    }
-    return (int)(hash % modulo);
-}
 picolArray* picolArrCreate(picolInterp* interp, const char* name) {
     char buf[PICOL_MAX_STR];
     int i;
@@ -0,0 +1,19 @@
+#pragma once
+#include "pvp.h"
+
+/*
+ * Guest PC sampling. With no period every exit is a sample,
+ * otherwise the first exit after each period is, and a VMM
+ * timer makes sure there is one even if the guest never exits
+ * on its own. Samples are kept as (PC, LR) pairs and attributed
+ * to pages, or to symbols from an nm-style map file.
+ */
+err_t prof_start(uint32_t period_us);
+void prof_stop(void);
+void prof_clear(void);
+void prof_exit(void);
+err_t prof_load_map(const char *path);
+void prof_top(count_t count, bool pages);
+err_t prof_folded(const char *path);
+void prof_mon_dump(void);
+void prof_bye(void);
@@ -0,0 +1,34 @@
+#pragma once
+#include "pvp.h"
+
+/*
+ * Paravirtual console. The guest branches to the trampoline
+ * (advertised as "pvp,hcall" on the console node) with the
+ * function in r3, and gets the result back in r3.
+ *
+ * PVCON_WRITE: r4 = buffer EA, r5 = length. Returns the
+ *   number of bytes written.
+ * PVCON_RING: r4 = ring RA (0 to tear down), r5 = data size,
+ *   a power of two. Returns 0 or -1.
+ * PVCON_KICK: drains the ring. Returns 0.
+ *
+ * The ring is pvcon_ring_t followed by the data, in guest
+ * physical memory and guest byte order. The guest writes at
+ * data[head % data size] and then advances head, the host
+ * advances tail. The ring is drained on every exit, so the
+ * guest only needs to kick when it's full or it wants the
+ * output seen right away.
+ */
+#define PVCON_WRITE 1
+#define PVCON_RING  2
+#define PVCON_KICK  3
+
+typedef struct pvcon_ring_s {
+  uint32_t head;
+  uint32_t tail;
+} pvcon_ring_t;
+
+err_t pvcon_init(gra_t trampoline);
+err_t pvcon_call(void);
+void pvcon_poll(void);
+void pvcon_mon_dump(void);
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "pvp.h"
+
+/*
+ * Single-producer, single-consumer byte ring. The producer only
+ * moves tail and the consumer only moves head, so the two sides
+ * can run on different threads without a lock. size must be a
+ * power of two.
+ */
+typedef struct ring_s {
+  uint8_t *buf;
+  length_t size;
+  volatile length_t head;
+  volatile length_t tail;
+} ring_t;
+
+#define ring_mb() __asm__ __volatile__("sync" ::: "memory")
+
+static inline err_t
+ring_init(ring_t *r,
+          length_t size)
+{
+  r->buf = malloc(size);
+  if (r->buf == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  r->size = size;
+  r->head = r->tail = 0;
+  return ERR_NONE;
+}
+
+static inline void
+ring_free(ring_t *r)
+{
+  free(r->buf);
+  r->buf = NULL;
+}
+
+static inline length_t
+ring_count(ring_t *r)
+{
+  return r->tail - r->head;
+}
+
+static inline length_t
+ring_space(ring_t *r)
+{
+  return r->size - ring_count(r);
+}
+
+/*
+ * Producer side.
+ */
+static inline length_t
+ring_put(ring_t *r,
+         const uint8_t *buf,
+         length_t len)
+{
+  length_t first;
+  length_t tail = r->tail;
+
+  len = min(len, ring_space(r));
+  first = min(len, r->size - (tail & (r->size - 1)));
+  memcpy(r->buf + (tail & (r->size - 1)), buf, first);
+  memcpy(r->buf, buf + first, len - first);
+
+  /*
+   * Data must be visible before the new tail is.
+   */
+  ring_mb();
+  r->tail = tail + len;
+  return len;
+}
+
+/*
+ * Consumer side.
+ */
+static inline length_t
+ring_get(ring_t *r,
+         uint8_t *buf,
+         length_t len)
+{
+  length_t first;
+  length_t head = r->head;
+
+  len = min(len, ring_count(r));
+  if (len == 0) {
+    return 0;
+  }
+
+  /*
+   * Don't read data older than the tail we just saw.
+   */
+  ring_mb();
+  first = min(len, r->size - (head & (r->size - 1)));
+  memcpy(buf, r->buf + (head & (r->size - 1)), first);
+  memcpy(buf + first, r->buf, len - first);
+
+  ring_mb();
+  r->head = head + len;
+  return len;
+}
+
+/*
+ * Consumer side, for handing ring contents straight to write():
+ * returns the longest contiguous run of queued data, which
+ * ring_consume() then releases.
+ */
+static inline const uint8_t *
+ring_peek(ring_t *r,
+          length_t *len)
+{
+  length_t head = r->head;
+
+  *len = ring_count(r);
+  if (*len == 0) {
+    return NULL;
+  }
+
+  ring_mb();
+  *len = min(*len, r->size - (head & (r->size - 1)));
+  return r->buf + (head & (r->size - 1));
+}
+
+static inline void
+ring_consume(ring_t *r,
+             length_t len)
+{
+  ring_mb();
+  r->head += len;
+}
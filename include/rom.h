@@ -3,8 +3,13 @@
 #include "pvp.h"
 #include "guest.h"
 
+err_t rom_add_disk(const char *path, bool read_only);
 err_t rom_init(const char *fdt_path);
 err_t rom_call(void);
+const char *rom_last_service(void);
+unsigned rom_last_service_id(void);
+const char *rom_service_name(unsigned id);
 err_t rom_fault(gea_t gea, gra_t *gra,
                 guest_fault_t flags);
 void rom_mon_dump(void);
+void rom_arena_usage(length_t *used, length_t *size);
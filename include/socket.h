@@ -1,18 +1,95 @@
 #pragma once
 
 #include "pvp.h"
+#include "io.h"
+#include "ring.h"
+#include "telnet.h"
+
+#include <sys/uio.h>
+#include <pthread.h>
+
+#define SOCKET_MAX_CLIENTS 8
+#define SOCKET_IN_MAX      MB(256)
+
+struct socket_s;
+
+/*
+ * Output to a client is queued and written out by the I/O
+ * thread, so a slow client only ever loses its own output.
+ * pending and hangup are set by the I/O thread, connected
+ * and clearing in_use belong to the VM thread.
+ */
+typedef struct socket_client_s {
+  struct socket_s *s;
+  int fd;
+  volatile bool in_use;
+  volatile bool pending;
+  volatile bool hangup;
+  bool connected;
+  io_watch_t in_watch;
+  io_watch_t out_watch;
+  ring_t out;
+  volatile bool out_armed;
+  uint64_t dropped;
+  /*
+   * Connect order, for handing over the input.
+   */
+  uint64_t seq;
+  telnet_t tn;
+} socket_client_t;
 
 typedef struct socket_s {
+  /*
+   * TCP port, or a Unix domain socket if path is set.
+   */
   int port;
-  int fd;
+  const char *path;
+  /*
+   * Clients beyond the first only see output. The
+   * monitor is lossless, i.e. waits for queue space
+   * instead of dropping output.
+   */
+  unsigned max_clients;
+  bool lossless;
+  /*
+   * Input queued while the guest isn't reading, rounded
+   * up to a power of two. Past that, the writer is
+   * throttled (not read from) until half of it drains.
+   */
+  length_t in_size;
+  /*
+   * Speak telnet to clients: negotiate on connect, strip
+   * commands from input and escape 0xff in output.
+   */
+  bool telnet;
   int sockfd;
-  void (*on_disconnect)(struct socket_s *s);
-  void (*on_connect)(struct socket_s *s);
+  void (*on_disconnect)(struct socket_s *s, socket_client_t *c);
+  void (*on_connect)(struct socket_s *s, socket_client_t *c);
+  unsigned connected;
+  /*
+   * Set by the I/O thread, consumed by the VM thread.
+   */
+  io_watch_t listen;
+  socket_client_t clients[SOCKET_MAX_CLIENTS];
+  socket_client_t *volatile writer;
+  socket_client_t *volatile throttled;
+  uint64_t next_seq;
+  volatile bool events;
+  ring_t in;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
 } socket_t;
 
 err_t socket_init(socket_t *s);
 void socket_out(socket_t *s, const char *buf, length_t len);
+void socket_outv(socket_t *s, struct iovec *iov, int iovcnt);
+void socket_client_out(socket_t *s, socket_client_t *c,
+                       const char *buf, length_t len);
+void socket_client_outv(socket_t *s, socket_client_t *c,
+                        struct iovec *iov, int iovcnt);
 length_t socket_in(socket_t *s, char *buf, length_t expected);
-void socket_disconnect(socket_t *s);
 err_t socket_handle_connect(socket_t *s);
 bool socket_connected(socket_t *s);
+void socket_wait_connect(socket_t *s);
+void socket_wait_input(socket_t *s);
+void socket_bye(socket_t *s);
@@ -0,0 +1,18 @@
+#pragma once
+#include "pvp.h"
+#include "vmm.h"
+#include "hist.h"
+
+/*
+ * Exit accounting: a count and a histogram of host handling
+ * time for each vmm return code, each CIF service and each
+ * kind of emulated instruction.
+ */
+void stats_init(void);
+void stats_exit(vmm_return_code_t code, uint64_t start_ns);
+void stats_cif(const char *service, uint64_t start_ns);
+void stats_emul(const char *op, uint64_t start_ns);
+void stats_reset(void);
+void stats_mon_dump(void);
+void stats_json(void);
+void stats_bye(void);
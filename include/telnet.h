@@ -0,0 +1,43 @@
+#pragma once
+#include "pvp.h"
+
+#define TELNET_IAC  255
+#define TELNET_DONT 254
+#define TELNET_DO   253
+#define TELNET_WONT 252
+#define TELNET_WILL 251
+#define TELNET_SB   250
+#define TELNET_IP   244
+#define TELNET_SE   240
+
+#define TELNET_OPT_ECHO 1
+#define TELNET_OPT_SGA  3
+#define TELNET_OPT_NAWS 31
+
+/*
+ * Per-connection receive state. Only NAWS subnegotiation
+ * is of interest, so sb is tiny.
+ */
+typedef struct telnet_s {
+  uint8_t state;
+  uint8_t cmd;
+  uint8_t sb[8];
+  unsigned sb_len;
+  uint16_t cols;
+  uint16_t rows;
+} telnet_t;
+
+/*
+ * What the server says on connect: it echoes and wants
+ * character mode (SGA both ways) and the window size.
+ */
+#define TELNET_HELLO "\377\373\001\377\373\003\377\375\003\377\375\037"
+
+/*
+ * Sends whatever telnet_in() has to say back to the client.
+ */
+typedef void (*telnet_reply_t)(void *arg, const uint8_t *buf, length_t len);
+
+void telnet_init(telnet_t *t);
+length_t telnet_in(telnet_t *t, uint8_t *buf, length_t len,
+                   telnet_reply_t reply, void *arg);
@@ -1,7 +1,14 @@
 #pragma once
 #include "pvp.h"
 
-err_t term_init(void);
+err_t term_init(bool headless, const char *log_path,
+                const char *script_path, const char *sock_path,
+                length_t in_size);
+err_t term_record(const char *record_path, const char *replay_path);
+bool term_recording(void);
 void term_out(const char *buf, length_t len);
+void term_out_xlat(const uint8_t *buf, length_t len);
+void term_flush(void);
+void term_io_counts(uint64_t *in_bytes, uint64_t *out_bytes);
 length_t term_in(char *buf, length_t expected);
 void term_bye(void);
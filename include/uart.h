@@ -0,0 +1,5 @@
+#pragma once
+#include "pvp.h"
+
+err_t uart_init(gra_t base);
+void uart_mon_dump(void);
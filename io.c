@@ -0,0 +1,158 @@
+/*
+ * The I/O thread. Everything that needs to wait on a file
+ * descriptor (listening sockets, connected consoles) registers
+ * an io_watch_t, and its callback is run from here instead of
+ * being polled from the VM loop.
+ *
+ * There's no epoll on OS X, so this is kqueue. All watches are
+ * level-triggered.
+ */
+
+#define LOG_PFX IO
+#include "io.h"
+
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <fcntl.h>
+
+#define IO_EVENTS 16
+
+static int kq = -1;
+static int wake_pipe[2] = { -1, -1 };
+static pthread_t thread;
+static bool running;
+
+static err_t
+io_change(io_watch_t *w,
+          unsigned short flags)
+{
+  struct kevent ev;
+
+  EV_SET(&ev, w->fd, w->write ? EVFILT_WRITE : EVFILT_READ,
+         flags, 0, 0, w);
+  if (kevent(kq, &ev, 1, NULL, 0, NULL) < 0) {
+    POSIX_ERROR(errno, "kevent fd %d flags 0x%x", w->fd, flags);
+    return ERR_POSIX;
+  }
+
+  return ERR_NONE;
+}
+
+static void *
+io_thread(void *unused)
+{
+  int i;
+  int n;
+  struct kevent evs[IO_EVENTS];
+
+  while (1) {
+    n = kevent(kq, NULL, 0, evs, IO_EVENTS, NULL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      POSIX_ERROR(errno, "kevent wait");
+      break;
+    }
+
+    for (i = 0; i < n; i++) {
+      io_watch_t *w = evs[i].udata;
+
+      if (w == NULL) {
+        /*
+         * io_bye().
+         */
+        return NULL;
+      }
+
+      w->cb(w);
+    }
+  }
+
+  return NULL;
+}
+
+err_t
+io_watch(io_watch_t *w)
+{
+  return io_change(w, EV_ADD | EV_ENABLE);
+}
+
+/*
+ * Only safe from the I/O thread (i.e. from a callback),
+ * or once io_bye() has stopped it.
+ */
+void
+io_unwatch(io_watch_t *w)
+{
+  if (running) {
+    io_change(w, EV_DELETE);
+  }
+}
+
+void
+io_enable(io_watch_t *w,
+          bool enable)
+{
+  if (running) {
+    io_change(w, enable ? EV_ENABLE : EV_DISABLE);
+  }
+}
+
+bool
+io_running(void)
+{
+  return running;
+}
+
+err_t
+io_init(void)
+{
+  int ret;
+  struct kevent ev;
+
+  kq = kqueue();
+  if (kq < 0) {
+    POSIX_ERROR(errno, "kqueue");
+    return ERR_POSIX;
+  }
+
+  ret = pipe(wake_pipe);
+  ON_POSIX_ERROR("wake pipe", ret, posix_err);
+
+  EV_SET(&ev, wake_pipe[0], EVFILT_READ, EV_ADD, 0, 0, NULL);
+  ret = kevent(kq, &ev, 1, NULL, 0, NULL);
+  ON_POSIX_ERROR("wake pipe kevent", ret, posix_err);
+
+  ret = pthread_create(&thread, NULL, io_thread, NULL);
+  if (ret != 0) {
+    POSIX_ERROR(ret, "could not start I/O thread");
+    return ERR_POSIX;
+  }
+
+  running = true;
+  return ERR_NONE;
+ posix_err:
+  return ERR_POSIX;
+}
+
+void
+io_bye(void)
+{
+  char c = 0;
+
+  if (!running) {
+    return;
+  }
+
+  write(wake_pipe[1], &c, 1);
+  pthread_join(thread, NULL);
+  running = false;
+
+  close(wake_pipe[0]);
+  close(wake_pipe[1]);
+  close(kq);
+}
@@ -0,0 +1,129 @@
+#include "pvp.h"
+#include "hist.h"
+
+#include <mach/mach_time.h>
+
+static unsigned
+hist_index(uint64_t value)
+{
+  unsigned msb;
+  unsigned shift;
+
+  if (value < HIST_SUB) {
+    return value;
+  }
+
+  msb = 63 - __builtin_clzll(value);
+  shift = msb - HIST_SUB_BITS;
+  if (shift + 1 >= HIST_MAX_BITS - HIST_SUB_BITS + 1) {
+    return HIST_BUCKETS - 1;
+  }
+
+  return (shift + 1) * HIST_SUB + ((value >> shift) - HIST_SUB);
+}
+
+/*
+ * Smallest value that maps to the bucket.
+ */
+static uint64_t
+hist_bucket_base(unsigned index)
+{
+  unsigned mag = index / HIST_SUB;
+  unsigned sub = index % HIST_SUB;
+
+  if (mag == 0) {
+    return sub;
+  }
+
+  return (uint64_t) (HIST_SUB + sub) << (mag - 1);
+}
+
+void
+hist_init(hist_t *h)
+{
+  memset(h, 0, sizeof(*h));
+}
+
+void
+hist_record(hist_t *h,
+            uint64_t value)
+{
+  if (h->count == 0 || value < h->min) {
+    h->min = value;
+  }
+
+  if (value > h->max) {
+    h->max = value;
+  }
+
+  h->count++;
+  h->sum += value;
+  h->buckets[hist_index(value)]++;
+}
+
+uint64_t
+hist_percentile(hist_t *h,
+                unsigned permille)
+{
+  unsigned i;
+  uint64_t seen = 0;
+  uint64_t want;
+
+  if (h->count == 0) {
+    return 0;
+  }
+
+  want = (h->count * permille + 999) / 1000;
+  if (want == 0) {
+    want = 1;
+  }
+
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= want) {
+      return max(hist_bucket_base(i), h->min);
+    }
+  }
+
+  return h->max;
+}
+
+int
+hist_format(hist_t *h,
+            const char *unit,
+            char *buf,
+            length_t size)
+{
+  if (h->count == 0) {
+    return snprintf(buf, size, "n=0");
+  }
+
+  return snprintf(buf, size, "n=%llu min=%llu%s avg=%llu%s p50=%llu%s "
+                  "p90=%llu%s p99=%llu%s p99.9=%llu%s max=%llu%s",
+                  h->count,
+                  h->min, unit,
+                  h->sum / h->count, unit,
+                  hist_percentile(h, 500), unit,
+                  hist_percentile(h, 900), unit,
+                  hist_percentile(h, 990), unit,
+                  hist_percentile(h, 999), unit,
+                  h->max, unit);
+}
+
+uint64_t
+hist_time_ns(void)
+{
+  uint64_t t;
+  static mach_timebase_info_data_t tb;
+
+  if (tb.denom == 0) {
+    mach_timebase_info(&tb);
+  }
+
+  /*
+   * numer is around 1e9 on PPC, so t * numer would wrap
+   * after a few minutes of uptime.
+   */
+  t = mach_absolute_time();
+  return (t / tb.denom) * tb.numer + (t % tb.denom) * tb.numer / tb.denom;
+}
@@ -0,0 +1,189 @@
+/*
+ * Registry of emulated device ranges.
+ *
+ * Unclaimed addresses within a page that has a device float,
+ * like on ISA: reads return all-ones, writes are dropped.
+ */
+
+#define LOG_PFX MMIO
+#include "mmio.h"
+#include "guest.h"
+#include "mon.h"
+
+static LIST_HEAD(mmio_ranges);
+static mmio_range_t *last;
+static bool hit;
+
+void
+mmio_add(mmio_range_t *m)
+{
+  m->reads = 0;
+  m->writes = 0;
+  m->shadow_maps = 0;
+  list_add_tail(&m->link, &mmio_ranges);
+  LOG("%s at 0x%x-0x%x", m->name, m->base, m->base + m->size - 1);
+}
+
+static mmio_range_t *
+mmio_find(gra_t ra)
+{
+  mmio_range_t *m;
+
+  /*
+   * Devices are polled in tight loops, so the
+   * last one hit is almost always the right one.
+   */
+  if (last != NULL && ra - last->base < last->size) {
+    return last;
+  }
+
+  list_for_each_entry(m, &mmio_ranges, link) {
+    if (ra - m->base < m->size) {
+      last = m;
+      return m;
+    }
+  }
+
+  return NULL;
+}
+
+bool
+mmio_page(gra_t ra)
+{
+  mmio_range_t *m;
+
+  ra &= ~PAGE_MASK;
+  list_for_each_entry(m, &mmio_ranges, link) {
+    if (ra <= m->base + m->size - 1 &&
+        m->base <= ra + PAGE_SIZE - 1) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+err_t
+mmio_read(gra_t ra,
+          length_t size,
+          uint32_t *val)
+{
+  mmio_range_t *m = mmio_find(ra);
+
+  if (m == NULL) {
+    *val = 0xffffffff >> (32 - size * 8);
+    return ERR_NONE;
+  }
+
+  hit = true;
+  m->reads++;
+  return m->read(m, ra - m->base, size, val);
+}
+
+err_t
+mmio_write(gra_t ra,
+           length_t size,
+           uint32_t val)
+{
+  mmio_range_t *m = mmio_find(ra);
+
+  if (m == NULL) {
+    return ERR_NONE;
+  }
+
+  hit = true;
+  m->writes++;
+  return m->write(m, ra - m->base, size, val);
+}
+
+void
+mmio_sync(void)
+{
+  mmio_range_t *m;
+
+  if (hit) {
+    hit = false;
+    return;
+  }
+
+  list_for_each_entry(m, &mmio_ranges, link) {
+    if (m->sync != NULL) {
+      m->sync(m);
+    }
+  }
+}
+
+/*
+ * Load fault on a device page. Maps in the device's shadow
+ * page instead of emulating the load, if the device has the
+ * page to itself and can do without seeing reads right now.
+ */
+bool
+mmio_shadow_map(gea_t ea,
+                gra_t ra)
+{
+  err_t err;
+  uint8_t *page;
+  mmio_range_t *m;
+  mmio_range_t *found = NULL;
+
+  ra &= ~PAGE_MASK;
+  list_for_each_entry(m, &mmio_ranges, link) {
+    if (ra <= m->base + m->size - 1 &&
+        m->base <= ra + PAGE_SIZE - 1) {
+      if (found != NULL) {
+        return false;
+      }
+      found = m;
+    }
+  }
+
+  m = found;
+  if (m == NULL || m->shadow == NULL ||
+      (page = m->shadow(m)) == NULL) {
+    return false;
+  }
+
+  /*
+   * Stale entries pile up as the guest remaps,
+   * so just start over.
+   */
+  if (m->shadow_maps == MMIO_SHADOW_MAPS) {
+    mmio_shadow_revoke(m);
+  }
+
+  ea &= ~PAGE_MASK;
+  err = guest_map_prot((ha_t) page, ea, VM_PROT_READ);
+  if (err != ERR_NONE) {
+    return false;
+  }
+
+  m->shadow_map[m->shadow_maps].index = guest->vmm->thread_index;
+  m->shadow_map[m->shadow_maps].ea = ea;
+  m->shadow_maps++;
+  return true;
+}
+
+void
+mmio_shadow_revoke(mmio_range_t *m)
+{
+  unsigned i;
+
+  for (i = 0; i < m->shadow_maps; i++) {
+    guest_unmap_in(m->shadow_map[i].index, m->shadow_map[i].ea);
+  }
+
+  m->shadow_maps = 0;
+}
+
+void
+mmio_mon_dump(void)
+{
+  mmio_range_t *m;
+
+  list_for_each_entry(m, &mmio_ranges, link) {
+    mon_printf("  %-8s 0x%08x-0x%08x reads %llu writes %llu\n",
+               m->name, m->base, m->base + m->size - 1,
+               m->reads, m->writes);
+  }
+}
@@ -5,6 +5,18 @@
 #include "pmem.h"
 #include "vmm.h"
 #include "rom.h"
+#include "disk.h"
+#include "mmio.h"
+#include "uart.h"
+#include "conlog.h"
+#include "pvcon.h"
+#include "bp.h"
+#include "stats.h"
+#include "etrace.h"
+#include "prof.h"
+
+#include <fcntl.h>
+#include <errno.h>
 
 #define PICOL_IMPLEMENTATION
 #define PICOL_INT_BASE_16    1
@@ -15,6 +27,8 @@
 #define SOURCE_FILE "pvp.pcl"
 #define PORT        7001
 #define IBUF_SIZE   PAGE_SIZE
+#define XFER_SIZE   (16 * PAGE_SIZE)
+#define FIND_MAX    64
 
 static socket_t s;
 static char *ibuf;
@@ -24,6 +38,47 @@ static err_t picol_err;
 static bool activated;
 static bool pend_prompt;
 
+/*
+ * Native filters checked after every exit before on_trace
+ * is even looked up. All set filters must match.
+ */
+static struct {
+  /*
+   * Mask of vmm return codes, 0 for any.
+   */
+  uint32_t exits;
+  bool pc;
+  gea_t pc_lo;
+  gea_t pc_hi;
+  char *cif;
+} trace_filter;
+
+/*
+ * on_trace compiled into commands, redone only when the
+ * variable changes. Commands made only of literal words
+ * are called directly, the rest go through picolEval.
+ */
+typedef struct {
+  int argc;
+  char **argv;
+  char *src;
+} trace_cmd_t;
+
+static struct {
+  char *src;
+  count_t count;
+  trace_cmd_t *cmds;
+} trace_hook;
+
+static const struct {
+  vmm_return_code_t code;
+  const char *name;
+} exit_names[] = {
+#define _VMM_RETURN_CODE(x) { x, #x },
+  VMM_RETURN_CODES
+#undef _VMM_RETURN_CODE
+};
+
 PICOL_COMMAND(quit) {
   PICOL_ARITY2(argc == 1, "quit");
 
@@ -127,6 +182,596 @@ PICOL_COMMAND(rom) {
   return PICOL_OK;
 }
 
+PICOL_COMMAND(disks) {
+  PICOL_ARITY(argc == 1);
+
+  disk_mon_dump();
+
+  return PICOL_OK;
+}
+
+PICOL_COMMAND(devs) {
+  PICOL_ARITY(argc == 1);
+
+  mon_printf("devices:\n");
+  mmio_mon_dump();
+  uart_mon_dump();
+  pvcon_mon_dump();
+
+  return PICOL_OK;
+}
+
+PICOL_COMMAND(conlog) {
+  PICOL_ARITY2((argc == 2 || argc == 3) &&
+               (!strcmp(argv[1], "tail") || argc == 3),
+               "conlog tail ?lines | conlog find pattern");
+
+  count_t count = 20;
+
+  if (!strcmp(argv[1], "tail")) {
+    if (argc == 3) {
+      PICOL_SCAN_INT(count, argv[2]);
+    }
+    conlog_tail(count);
+    return PICOL_OK;
+  } else if (!strcmp(argv[1], "find")) {
+    picolSetIntResult(interp, conlog_find(argv[2], 100));
+    return PICOL_OK;
+  }
+
+  return picolErrFmt(interp, "unknown conlog op '%s'", argv[1]);
+}
+
+static void
+tfilter_dump(void)
+{
+  unsigned i;
+
+  mon_printf("exit:");
+  if (trace_filter.exits == 0) {
+    mon_printf(" any");
+  }
+  for (i = 0; i < ARRAY_LEN(exit_names); i++) {
+    if (exit_names[i].code < 32 &&
+        (trace_filter.exits & (1U << exit_names[i].code)) != 0) {
+      mon_printf(" %s", exit_names[i].name);
+    }
+  }
+  mon_printf("\n");
+
+  if (trace_filter.pc) {
+    mon_printf("pc:   0x%08x-0x%08x\n", trace_filter.pc_lo,
+               trace_filter.pc_hi);
+  } else {
+    mon_printf("pc:   any\n");
+  }
+
+  mon_printf("cif:  %s\n", trace_filter.cif != NULL ?
+             trace_filter.cif : "any");
+}
+
+PICOL_COMMAND(tfilter) {
+  PICOL_ARITY2(argc == 1 ||
+               (argc == 2 && !strcmp(argv[1], "clear")) ||
+               (argc >= 3 && !strcmp(argv[1], "exit")) ||
+               (argc == 4 && !strcmp(argv[1], "pc")) ||
+               (argc == 3 && !strcmp(argv[1], "cif")),
+               "tfilter ?clear | exit code ... | pc lo hi | cif service?");
+
+  int i;
+  unsigned j;
+
+  if (argc == 1) {
+    tfilter_dump();
+    return PICOL_OK;
+  }
+
+  if (!strcmp(argv[1], "clear")) {
+    free(trace_filter.cif);
+    memset(&trace_filter, 0, sizeof(trace_filter));
+  } else if (!strcmp(argv[1], "exit")) {
+    uint32_t mask = 0;
+
+    for (i = 2; i < argc; i++) {
+      vmm_return_code_t code;
+      length_t len = strlen(argv[i]);
+
+      for (j = 0; j < ARRAY_LEN(exit_names); j++) {
+        length_t nlen = strlen(exit_names[j].name);
+
+        /*
+         * Full name or a suffix, e.g. SystemCall.
+         */
+        if (nlen >= len &&
+            !strcasecmp(exit_names[j].name + nlen - len, argv[i])) {
+          break;
+        }
+      }
+
+      if (j != ARRAY_LEN(exit_names)) {
+        code = exit_names[j].code;
+      } else {
+        PICOL_SCAN_INT(code, argv[i]);
+      }
+
+      if (code >= 32) {
+        return picolErrFmt(interp, "can't filter on exit '%s'", argv[i]);
+      }
+
+      mask |= 1U << code;
+    }
+
+    trace_filter.exits = mask;
+  } else if (!strcmp(argv[1], "pc")) {
+    PICOL_SCAN_INT(trace_filter.pc_lo, argv[2]);
+    PICOL_SCAN_INT(trace_filter.pc_hi, argv[3]);
+    trace_filter.pc = true;
+  } else {
+    free(trace_filter.cif);
+    trace_filter.cif = strdup(argv[2]);
+  }
+
+  return PICOL_OK;
+}
+
+PICOL_COMMAND(stats) {
+  PICOL_ARITY2(argc == 1 || (argc == 2 && (!strcmp(argv[1], "reset") ||
+                                           !strcmp(argv[1], "json"))),
+               "stats ?reset | json");
+
+  if (argc == 1) {
+    stats_mon_dump();
+  } else if (!strcmp(argv[1], "json")) {
+    stats_json();
+  } else {
+    stats_reset();
+  }
+
+  return PICOL_OK;
+}
+
+PICOL_COMMAND(etrace) {
+  PICOL_ARITY2(argc == 1 || argc == 2, "etrace ?count");
+
+  count_t count = 20;
+
+  if (argc == 2) {
+    PICOL_SCAN_INT(count, argv[1]);
+  }
+
+  etrace_tail(count);
+  return PICOL_OK;
+}
+
+PICOL_COMMAND(prof) {
+  PICOL_ARITY2(argc == 1 ||
+               (argc <= 3 && !strcmp(argv[1], "start")) ||
+               (argc == 2 && !strcmp(argv[1], "stop")) ||
+               (argc == 2 && !strcmp(argv[1], "clear")) ||
+               (argc <= 3 && !strcmp(argv[1], "top")) ||
+               (argc <= 3 && !strcmp(argv[1], "pages")) ||
+               (argc == 3 && !strcmp(argv[1], "map")) ||
+               (argc == 3 && !strcmp(argv[1], "folded")),
+               "prof ?start ?us | stop | clear | top ?n | pages ?n | "
+               "map file | folded file");
+
+  err_t err = ERR_NONE;
+
+  if (argc == 1) {
+    prof_mon_dump();
+  } else if (!strcmp(argv[1], "start")) {
+    uint32_t period = 0;
+
+    if (argc == 3) {
+      PICOL_SCAN_INT(period, argv[2]);
+    }
+    err = prof_start(period);
+  } else if (!strcmp(argv[1], "stop")) {
+    prof_stop();
+  } else if (!strcmp(argv[1], "clear")) {
+    prof_clear();
+  } else if (!strcmp(argv[1], "map")) {
+    err = prof_load_map(argv[2]);
+  } else if (!strcmp(argv[1], "folded")) {
+    err = prof_folded(argv[2]);
+  } else {
+    count_t count = 20;
+
+    if (argc == 3) {
+      PICOL_SCAN_INT(count, argv[2]);
+    }
+    prof_top(count, !strcmp(argv[1], "pages"));
+  }
+
+  if (err != ERR_NONE) {
+    return picolErrFmt(interp, "%s", err_to_string(err));
+  }
+
+  return PICOL_OK;
+}
+
+PICOL_COMMAND(bp) {
+  PICOL_ARITY2(argc == 1 || argc == 2 ||
+               (argc == 3 && !strcmp(argv[1], "del")),
+               "bp ?ea | bp del ea");
+
+  gea_t ea;
+  err_t err;
+
+  if (argc == 1) {
+    bp_mon_dump();
+    return PICOL_OK;
+  }
+
+  if (argc == 3) {
+    PICOL_SCAN_INT(ea, argv[2]);
+    err = bp_del(ea);
+  } else {
+    PICOL_SCAN_INT(ea, argv[1]);
+    err = bp_add(ea);
+  }
+
+  if (err != ERR_NONE) {
+    return picolErrFmt(interp, "%s", err_to_string(err));
+  }
+
+  return PICOL_OK;
+}
+
+PICOL_COMMAND(wp) {
+  PICOL_ARITY2(argc <= 4, "wp ?ea ?len ?w|rw | wp del ea");
+
+  gea_t ea;
+  err_t err;
+  length_t len = 4;
+  bool write = true;
+
+  if (argc == 1) {
+    bp_mon_dump();
+    return PICOL_OK;
+  }
+
+  if (!strcmp(argv[1], "del")) {
+    PICOL_ARITY2(argc == 3, "wp del ea");
+    PICOL_SCAN_INT(ea, argv[2]);
+    err = wp_del(ea);
+  } else {
+    PICOL_SCAN_INT(ea, argv[1]);
+    if (argc >= 3) {
+      PICOL_SCAN_INT(len, argv[2]);
+    }
+    if (argc == 4) {
+      if (!strcmp(argv[3], "rw")) {
+        write = false;
+      } else if (strcmp(argv[3], "w")) {
+        return picolErrFmt(interp, "expected w or rw but got '%s'", argv[3]);
+      }
+    }
+    err = wp_add(ea, len, write);
+  }
+
+  if (err != ERR_NONE) {
+    return picolErrFmt(interp, "%s", err_to_string(err));
+  }
+
+  return PICOL_OK;
+}
+
+/*
+ * Bulk transfers go many pages per call. A virtual transfer
+ * stops short at the first page that doesn't translate.
+ */
+static length_t
+mon_xfer_from(void *dest, uint32_t src, length_t bytes, bool virt)
+{
+  return virt ? guest_from_ex(dest, src, bytes, 1, false) :
+    pmem_from(dest, src, bytes, 1);
+}
+
+static length_t
+mon_xfer_to(uint32_t dest, const void *src, length_t bytes, bool virt)
+{
+  if (virt) {
+    return guest_to(dest, src, bytes, 1) == ERR_NONE ? bytes : 0;
+  }
+
+  return pmem_to(dest, src, bytes, 1);
+}
+
+PICOL_COMMAND(savemem) {
+  PICOL_ARITY2(argc == 4, "savemem/savepmem addr len file");
+
+  int fd;
+  uint32_t addr;
+  length_t len;
+  length_t done = 0;
+  static uint8_t buf[XFER_SIZE];
+  bool virt = strcmp(argv[0], "savepmem") != 0;
+
+  PICOL_SCAN_INT(addr, argv[1]);
+  PICOL_SCAN_INT(len, argv[2]);
+
+  fd = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return picolErrFmt(interp, "%s", strerror(errno));
+  }
+
+  while (done < len) {
+    length_t chunk = min(len - done, XFER_SIZE);
+    length_t got = mon_xfer_from(buf, addr + done, chunk, virt);
+
+    if (got != 0 && write(fd, buf, got) != got) {
+      close(fd);
+      return picolErrFmt(interp, "%s", strerror(errno));
+    }
+
+    done += got;
+    if (got != chunk) {
+      break;
+    }
+  }
+
+  close(fd);
+  if (done != len) {
+    mon_printf("stopped at 0x%x: %s\n", addr + done,
+               err_to_string(ERR_BAD_ACCESS));
+  }
+
+  picolSetIntResult(interp, done);
+  return PICOL_OK;
+}
+
+PICOL_COMMAND(loadmem) {
+  PICOL_ARITY2(argc == 3, "loadmem/loadpmem file addr");
+
+  int fd;
+  uint32_t addr;
+  ssize_t got;
+  length_t done = 0;
+  static uint8_t buf[XFER_SIZE];
+  bool virt = strcmp(argv[0], "loadpmem") != 0;
+
+  PICOL_SCAN_INT(addr, argv[2]);
+
+  fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    return picolErrFmt(interp, "%s", strerror(errno));
+  }
+
+  while ((got = read(fd, buf, sizeof(buf))) > 0) {
+    length_t put = mon_xfer_to(addr + done, buf, got, virt);
+
+    done += put;
+    if (put != got) {
+      break;
+    }
+  }
+
+  close(fd);
+  if (got < 0) {
+    return picolErrFmt(interp, "%s", strerror(errno));
+  } else if (got != 0) {
+    mon_printf("stopped at 0x%x: %s\n", addr + done,
+               err_to_string(ERR_BAD_ACCESS));
+  }
+
+  picolSetIntResult(interp, done);
+  return PICOL_OK;
+}
+
+PICOL_COMMAND(hexdump) {
+  PICOL_ARITY2(argc == 2 || argc == 3, "hexdump/phexdump addr ?len");
+
+  uint32_t addr;
+  length_t len = 0x100;
+  length_t off, got;
+  static uint8_t buf[XFER_SIZE];
+  bool virt = argv[0][0] != 'p';
+
+  PICOL_SCAN_INT(addr, argv[1]);
+  if (argc == 3) {
+    PICOL_SCAN_INT(len, argv[2]);
+  }
+
+  while (len != 0) {
+    length_t chunk = min(len, XFER_SIZE);
+
+    got = mon_xfer_from(buf, addr, chunk, virt);
+    for (off = 0; off < got; off += 16) {
+      unsigned i;
+      char line[sizeof("0x12345678: ") + 16 * 3 + sizeof(" |0123456789abcdef|")];
+      char *p = line + sprintf(line, "0x%08x: ", addr + off);
+      length_t n = min(got - off, 16);
+
+      for (i = 0; i < 16; i++) {
+        if (i < n) {
+          p += sprintf(p, "%02x ", buf[off + i]);
+        } else {
+          p += sprintf(p, "   ");
+        }
+      }
+
+      *p++ = '|';
+      for (i = 0; i < n; i++) {
+        *p++ = isprint(buf[off + i]) ? buf[off + i] : '.';
+      }
+      *p++ = '|';
+      *p = '\0';
+      mon_printf("%s\n", line);
+    }
+
+    if (got != chunk) {
+      return picolErrFmt(interp, "%s", err_to_string(ERR_BAD_ACCESS));
+    }
+
+    addr += chunk;
+    len -= chunk;
+  }
+
+  return PICOL_OK;
+}
+
+/*
+ * One page for find. Virtual pages that don't translate
+ * read as empty rather than ending the search.
+ */
+static length_t
+mon_find_read(void *dest, uint32_t addr, length_t bytes,
+              length_t access_size, bool virt)
+{
+  gra_t gra = addr;
+
+  if (virt && guest_backmap(addr, &gra) != ERR_NONE) {
+    return 0;
+  }
+
+  return pmem_from(dest, gra, bytes, access_size);
+}
+
+/*
+ * Hits go into the result as a list, for as many as picol
+ * can take.
+ */
+static bool
+mon_find_hit(char *res, length_t *used, uint32_t addr)
+{
+  int n;
+
+  n = snprintf(res + *used, PICOL_MAX_STR - *used, "%s0x%x",
+               *used != 0 ? " " : "", addr);
+  if (*used + n >= PICOL_MAX_STR) {
+    res[*used] = '\0';
+    return false;
+  }
+
+  *used += n;
+  return true;
+}
+
+PICOL_COMMAND(find) {
+  PICOL_ARITY2(argc >= 5 &&
+               ((!strcmp(argv[3], "str") && argc == 5) ||
+                (!strcmp(argv[3], "bytes") && argc - 4 <= FIND_MAX) ||
+                (!strcmp(argv[3], "word") && argc <= 6)),
+               "find/pfind addr len str text | bytes b ... | word val ?mask");
+
+  int i;
+  uint32_t addr;
+  uint32_t end;
+  length_t len;
+  length_t plen;
+  length_t carry = 0;
+  length_t used = 0;
+  count_t hits = 0;
+  count_t lost = 0;
+  uint8_t pat[FIND_MAX];
+  char res[PICOL_MAX_STR] = "";
+  static uint8_t buf[FIND_MAX + PAGE_SIZE];
+  bool virt = argv[0][0] != 'p';
+  bool word = !strcmp(argv[3], "word");
+  uint32_t val = 0;
+  uint32_t mask = 0xffffffff;
+
+  PICOL_SCAN_INT(addr, argv[1]);
+  PICOL_SCAN_INT(len, argv[2]);
+
+  if (word) {
+    PICOL_SCAN_INT(val, argv[4]);
+    if (argc == 6) {
+      PICOL_SCAN_INT(mask, argv[5]);
+    }
+    if ((addr & 3) != 0) {
+      return picolErrFmt(interp, "%s", err_to_string(ERR_BAD_ACCESS));
+    }
+    val &= mask;
+    plen = sizeof(uint32_t);
+  } else if (!strcmp(argv[3], "str")) {
+    plen = strlen(argv[4]);
+    if (plen == 0 || plen > FIND_MAX) {
+      return picolErr(interp, "pattern must be 1-64 bytes");
+    }
+    memcpy(pat, argv[4], plen);
+  } else {
+    plen = argc - 4;
+    for (i = 4; i < argc; i++) {
+      PICOL_SCAN_INT(pat[i - 4], argv[i]);
+    }
+  }
+
+  /*
+   * Stop short of wrapping around, and whole words only.
+   */
+  end = len > UINT32_MAX - addr ? UINT32_MAX : addr + len;
+  if (word) {
+    end = addr + ((end - addr) & ~3);
+  }
+
+  while (addr < end) {
+    length_t chunk = min(PAGE_SIZE - (addr & PAGE_MASK), end - addr);
+    length_t got = mon_find_read(buf + carry, addr, chunk,
+                                 word ? sizeof(uint32_t) : 1, virt);
+
+    if (got == 0 && !virt) {
+      break;
+    }
+
+    if (word) {
+      uint32_t *w = (uint32_t *) buf;
+      uint32_t *w_end = w + got / sizeof(uint32_t);
+
+      for (; w < w_end; w++) {
+        if ((*w & mask) == val) {
+          uint32_t hit = addr + ((uint8_t *) w - buf);
+
+          hits++;
+          if (lost != 0 || !mon_find_hit(res, &used, hit)) {
+            lost++;
+          }
+        }
+      }
+    } else {
+      /*
+       * The bytes carried over from the last page catch
+       * matches straddling the boundary.
+       */
+      uint8_t *p = buf;
+      length_t total = carry + got;
+      length_t keep = min(plen - 1, total);
+
+      while (total >= plen && p <= buf + total - plen) {
+        p = memchr(p, pat[0], buf + total - plen - p + 1);
+        if (p == NULL) {
+          break;
+        }
+
+        if (!memcmp(p + 1, pat + 1, plen - 1)) {
+          uint32_t hit = addr - carry + (p - buf);
+
+          hits++;
+          if (lost != 0 || !mon_find_hit(res, &used, hit)) {
+            lost++;
+          }
+        }
+        p++;
+      }
+
+      carry = 0;
+      if (got == chunk) {
+        memmove(buf, buf + total - keep, keep);
+        carry = keep;
+      }
+    }
+
+    addr += chunk;
+  }
+
+  if (lost != 0) {
+    mon_printf("%u hits, %u not in the result\n", hits, lost);
+  }
+
+  return picolSetResult(interp, res);
+}
+
 PICOL_COMMAND(dump) {
   PICOL_ARITY2(argc == 3 || argc == 2, "d8/d16/d32 ea ?count");
 
@@ -328,7 +973,8 @@ mon_prompt(void)
 }
 
 static void
-mon_on_connect(socket_t *s)
+mon_on_connect(socket_t *s,
+               socket_client_t *c)
 {
   const char *banner =
     "\nThis is the PVP monitor console\r\n"
@@ -339,16 +985,17 @@ mon_on_connect(socket_t *s)
 }
 
 static void
-mon_on_disconnect(socket_t *s)
+mon_on_disconnect(socket_t *s,
+                  socket_client_t *c)
 {
   const char *banner =
     "\r\n\nMonitor console closing...\r\n";
 
-  socket_out(s, banner, strlen(banner));
+  socket_client_out(s, c, banner, strlen(banner));
 }
 
 err_t
-mon_init(void)
+mon_init(const char *sock_path)
 {
   int rc;
   err_t err;
@@ -418,6 +1065,23 @@ mon_init(void)
   picolRegisterCmd(interp, "d16", picol_dump, NULL);
   picolRegisterCmd(interp, "d32", picol_dump, NULL);
   picolRegisterCmd(interp, "cpu", picol_cpu, NULL);
+  picolRegisterCmd(interp, "disks", picol_disks, NULL);
+  picolRegisterCmd(interp, "devs", picol_devs, NULL);
+  picolRegisterCmd(interp, "conlog", picol_conlog, NULL);
+  picolRegisterCmd(interp, "tfilter", picol_tfilter, NULL);
+  picolRegisterCmd(interp, "stats", picol_stats, NULL);
+  picolRegisterCmd(interp, "etrace", picol_etrace, NULL);
+  picolRegisterCmd(interp, "prof", picol_prof, NULL);
+  picolRegisterCmd(interp, "bp", picol_bp, NULL);
+  picolRegisterCmd(interp, "savemem", picol_savemem, NULL);
+  picolRegisterCmd(interp, "savepmem", picol_savemem, NULL);
+  picolRegisterCmd(interp, "loadmem", picol_loadmem, NULL);
+  picolRegisterCmd(interp, "loadpmem", picol_loadmem, NULL);
+  picolRegisterCmd(interp, "hexdump", picol_hexdump, NULL);
+  picolRegisterCmd(interp, "phexdump", picol_hexdump, NULL);
+  picolRegisterCmd(interp, "find", picol_find, NULL);
+  picolRegisterCmd(interp, "pfind", picol_find, NULL);
+  picolRegisterCmd(interp, "wp", picol_wp, NULL);
   picolRegisterCmd(interp, "rom", picol_rom, NULL);
 
   rc = picolSource(interp, SOURCE_FILE);
@@ -429,6 +1093,9 @@ mon_init(void)
   }
 
   s.port = PORT;
+  s.path = sock_path;
+  s.max_clients = 1;
+  s.lossless = true;
   s.on_connect = mon_on_connect;
   s.on_disconnect = mon_on_disconnect;
   err = socket_init(&s);
@@ -446,9 +1113,13 @@ mon_activate(void)
 
   activated = true;
   if (!was_connected) {
-    LOG("Waiting for monitor console connection on %u", PORT);
+    if (s.path != NULL) {
+      LOG("Waiting for monitor console connection on %s", s.path);
+    } else {
+      LOG("Waiting for monitor console connection on %u", PORT);
+    }
   }
-  while (socket_handle_connect(&s) != ERR_NONE);
+  socket_wait_connect(&s);
 
   if (!pend_prompt) {
     mon_printf("\n");
@@ -468,6 +1139,8 @@ mon_activate(void)
     } else if (err != ERR_NONE) {
       break;
     }
+
+    socket_wait_input(&s);
   }
 
   activated = false;
@@ -477,20 +1150,243 @@ mon_activate(void)
 void
 mon_bye(void)
 {
-  socket_disconnect(&s);
+  socket_bye(&s);
+}
+
+static bool
+mon_trace_match(void)
+{
+  if (trace_filter.exits != 0) {
+    vmm_return_code_t code = guest->vmm->return_code;
+
+    if (code >= 32 || (trace_filter.exits & (1U << code)) == 0) {
+      return false;
+    }
+  }
+
+  if (trace_filter.pc &&
+      (guest->exit_pc < trace_filter.pc_lo ||
+       guest->exit_pc > trace_filter.pc_hi)) {
+    return false;
+  }
+
+  if (trace_filter.cif != NULL) {
+    const char *service = rom_last_service();
+
+    if (service == NULL || strcmp(service, trace_filter.cif)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void
+trace_cmd_free(trace_cmd_t *tc)
+{
+  while (tc->argc != 0) {
+    free(tc->argv[--tc->argc]);
+  }
+  free(tc->argv);
+  free(tc->src);
+  memset(tc, 0, sizeof(*tc));
+}
+
+static void
+mon_trace_free(void)
+{
+  count_t i;
+
+  for (i = 0; i < trace_hook.count; i++) {
+    trace_cmd_free(&trace_hook.cmds[i]);
+  }
+
+  free(trace_hook.cmds);
+  free(trace_hook.src);
+  memset(&trace_hook, 0, sizeof(trace_hook));
+}
+
+static err_t
+trace_cmd_word(trace_cmd_t *tc,
+               picolParser *p)
+{
+  char *t;
+  char **argv;
+  size_t tlen = p->end < p->start ? 0 : p->end - p->start + 1;
+
+  argv = realloc(tc->argv, sizeof(char *) * (tc->argc + 1));
+  if (argv == NULL) {
+    return ERR_NO_MEM;
+  }
+  tc->argv = argv;
+
+  t = malloc(tlen + 1);
+  if (t == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  if (p->type == PICOL_PT_STR) {
+    tlen = picolExpandLC(t, tlen, p->start);
+  } else {
+    memcpy(t, p->start, tlen);
+  }
+  t[tlen] = '\0';
+  if (p->type == PICOL_PT_ESC && strchr(t, '\\') != NULL) {
+    picolEscape(t, tlen);
+  }
+
+  tc->argv[tc->argc++] = t;
+  return ERR_NONE;
+}
+
+static err_t
+trace_cmd_add(trace_cmd_t *tc,
+              bool literal,
+              const char *start,
+              const char *end)
+{
+  trace_cmd_t *cmds;
+
+  if (!literal) {
+    trace_cmd_free(tc);
+  }
+
+  tc->src = malloc(end - start + 1);
+  if (tc->src == NULL) {
+    return ERR_NO_MEM;
+  }
+  memcpy(tc->src, start, end - start);
+  tc->src[end - start] = '\0';
+
+  cmds = realloc(trace_hook.cmds, sizeof(trace_cmd_t) *
+                 (trace_hook.count + 1));
+  if (cmds == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  trace_hook.cmds = cmds;
+  trace_hook.cmds[trace_hook.count++] = *tc;
+  memset(tc, 0, sizeof(*tc));
+  return ERR_NONE;
+}
+
+static err_t
+mon_trace_compile(const char *src)
+{
+  picolParser p;
+  int prevtype;
+  const char *end;
+  err_t err = ERR_NONE;
+  trace_cmd_t tc = { 0 };
+  const char *start = src;
+  bool literal = true;
+
+  mon_trace_free();
+  trace_hook.src = strdup(src);
+  if (trace_hook.src == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  picolInitParser(&p, src);
+  do {
+    prevtype = p.type;
+    if (picolGetToken(interp, &p) != PICOL_OK) {
+      /*
+       * Leave the rest for picolEval to report.
+       */
+      end = start + strlen(start);
+      literal = false;
+      p.type = PICOL_PT_EOF;
+    } else {
+      end = p.pos;
+    }
+
+    if (p.type == PICOL_PT_EOL || p.type == PICOL_PT_EOF) {
+      if (tc.argc != 0 || !literal) {
+        err = trace_cmd_add(&tc, literal, start, end);
+        ON_ERROR("on_trace", err, fail);
+      }
+
+      start = p.pos;
+      literal = true;
+    } else if (p.type != PICOL_PT_SEP) {
+      /*
+       * Substitutions, {*} and words glued from several
+       * tokens are left to picolEval.
+       */
+      if ((p.type != PICOL_PT_STR && p.type != PICOL_PT_ESC) ||
+          (prevtype != PICOL_PT_SEP && prevtype != PICOL_PT_EOL)) {
+        literal = false;
+      }
+
+      if (literal) {
+        err = trace_cmd_word(&tc, &p);
+        ON_ERROR("on_trace", err, fail);
+      }
+    }
+  } while (p.type != PICOL_PT_EOF);
+
+  return ERR_NONE;
+
+ fail:
+  trace_cmd_free(&tc);
+  mon_trace_free();
+  return err;
+}
+
+static int
+mon_trace_run(void)
+{
+  count_t i;
+  int rc = PICOL_OK;
+
+  picolSetResult(interp, "");
+  for (i = 0; i < trace_hook.count && rc == PICOL_OK; i++) {
+    trace_cmd_t *tc = &trace_hook.cmds[i];
+    picolCmd *c = NULL;
+
+    if (tc->argv != NULL) {
+      c = picolGetCmd(interp, tc->argv[0]);
+    }
+
+    if (c == NULL) {
+      rc = picolEval(interp, tc->src);
+    } else {
+      picolSetResult(interp, "");
+      rc = c->func(interp, tc->argc, (const char **) tc->argv,
+                   c->privdata);
+    }
+  }
+
+  return rc;
 }
 
 err_t
 mon_trace(void)
 {
   int rc;
+  err_t err;
+
+  if (!mon_trace_match()) {
+    return ERR_NONE;
+  }
 
   picolVar *v = picolGetVar(interp, "on_trace");
-  if (v == NULL) {
+  if (v == NULL || v->val == NULL) {
+    if (trace_hook.src != NULL) {
+      mon_trace_free();
+    }
     return ERR_NONE;
   }
 
-  rc = picolEval(interp, v->val);
+  if (trace_hook.src == NULL || strcmp(trace_hook.src, v->val)) {
+    err = mon_trace_compile(v->val);
+    if (err != ERR_NONE) {
+      return ERR_NONE;
+    }
+  }
+
+  rc = mon_trace_run();
   if (interp->result[0] != '\0' || rc != PICOL_OK) {
     mon_printf("[%d] %s\n", rc, interp->result);
   }
@@ -0,0 +1,388 @@
+#define LOG_PFX PROF
+#include "prof.h"
+#include "guest.h"
+#include "mon.h"
+
+#include <errno.h>
+#include <mach/mach_time.h>
+
+/*
+ * (PC, LR) pairs, open addressed. Past 3/4 full, new pairs
+ * are only counted as dropped.
+ */
+#define PROF_BITS  16
+#define PROF_SLOTS (1U << PROF_BITS)
+#define SYM_LEN    64
+
+typedef struct {
+  gea_t pc;
+  gea_t lr;
+  uint64_t count;
+} prof_slot_t;
+
+typedef struct {
+  gea_t ea;
+  char name[SYM_LEN];
+} prof_sym_t;
+
+static struct {
+  bool running;
+  uint64_t period;
+  uint64_t deadline;
+  prof_slot_t *slots;
+  count_t used;
+  uint64_t samples;
+  uint64_t dropped;
+  prof_sym_t *syms;
+  count_t sym_count;
+} prof;
+
+err_t
+prof_start(uint32_t period_us)
+{
+  mach_timebase_info_data_t tb;
+
+  if (prof.slots == NULL) {
+    prof.slots = calloc(PROF_SLOTS, sizeof(prof_slot_t));
+    if (prof.slots == NULL) {
+      return ERR_NO_MEM;
+    }
+  }
+
+  mach_timebase_info(&tb);
+  prof.period = (uint64_t) period_us * 1000 * tb.denom / tb.numer;
+  prof.deadline = 0;
+  prof.running = true;
+  return ERR_NONE;
+}
+
+void
+prof_stop(void)
+{
+  if (prof.running && prof.period != 0) {
+    guest_set_timer(GUEST_TIMER_PROF, 0);
+  }
+
+  prof.running = false;
+}
+
+void
+prof_clear(void)
+{
+  if (prof.slots != NULL) {
+    memset(prof.slots, 0, PROF_SLOTS * sizeof(prof_slot_t));
+  }
+
+  prof.used = 0;
+  prof.samples = 0;
+  prof.dropped = 0;
+}
+
+static void
+prof_record(gea_t pc,
+            gea_t lr)
+{
+  uint32_t i = (((pc >> 2) ^ lr) * 0x9e3779b1U) >> (32 - PROF_BITS);
+
+  prof.samples++;
+  for (;; i = (i + 1) & (PROF_SLOTS - 1)) {
+    prof_slot_t *s = prof.slots + i;
+
+    if (s->count != 0 && s->pc == pc && s->lr == lr) {
+      s->count++;
+      return;
+    }
+
+    if (s->count == 0) {
+      if (prof.used >= PROF_SLOTS / 4 * 3) {
+        prof.dropped++;
+        return;
+      }
+
+      prof.used++;
+      s->pc = pc;
+      s->lr = lr;
+      s->count = 1;
+      return;
+    }
+  }
+}
+
+void
+prof_exit(void)
+{
+  if (!prof.running) {
+    return;
+  }
+
+  if (prof.period != 0) {
+    uint64_t now = mach_absolute_time();
+
+    if (now < prof.deadline) {
+      return;
+    }
+
+    prof.deadline = now + prof.period;
+    guest_set_timer(GUEST_TIMER_PROF, prof.deadline);
+  }
+
+  prof_record(guest->exit_pc, guest->regs->ppcLR);
+}
+
+static int
+prof_sym_cmp(const void *a,
+             const void *b)
+{
+  const prof_sym_t *x = a;
+  const prof_sym_t *y = b;
+
+  return x->ea < y->ea ? -1 : x->ea > y->ea;
+}
+
+/*
+ * Lines of "address name" or nm's "address type name".
+ */
+err_t
+prof_load_map(const char *path)
+{
+  FILE *f;
+  char line[256];
+  count_t size = 0;
+  count_t count = 0;
+  prof_sym_t *syms = NULL;
+
+  f = fopen(path, "r");
+  if (f == NULL) {
+    POSIX_ERROR(errno, "could not open symbol map '%s'", path);
+    return ERR_POSIX;
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    int n;
+    gea_t ea;
+    char *end;
+    char *name;
+    char addr[32];
+    char type[SYM_LEN];
+    char sym[SYM_LEN];
+
+    n = sscanf(line, "%31s %63s %63s", addr, type, sym);
+    if (n < 2) {
+      continue;
+    }
+
+    ea = strtoul(addr, &end, 16);
+    if (*end != '\0') {
+      continue;
+    }
+
+    name = n == 3 && strlen(type) == 1 ? sym : type;
+
+    if (count == size) {
+      prof_sym_t *n;
+
+      size = size != 0 ? size * 2 : 1024;
+      n = realloc(syms, size * sizeof(prof_sym_t));
+      if (n == NULL) {
+        free(syms);
+        fclose(f);
+        return ERR_NO_MEM;
+      }
+      syms = n;
+    }
+
+    syms[count].ea = ea;
+    strlcpy(syms[count].name, name, SYM_LEN);
+    count++;
+  }
+
+  fclose(f);
+  qsort(syms, count, sizeof(prof_sym_t), prof_sym_cmp);
+
+  free(prof.syms);
+  prof.syms = syms;
+  prof.sym_count = count;
+  LOG("%u symbols from '%s'", count, path);
+  return ERR_NONE;
+}
+
+/*
+ * Index of the closest symbol at or below ea, or sym_count
+ * if there isn't one.
+ */
+static count_t
+prof_sym_find(gea_t ea)
+{
+  count_t lo = 0;
+  count_t hi = prof.sym_count;
+
+  while (lo < hi) {
+    count_t mid = lo + (hi - lo) / 2;
+
+    if (prof.syms[mid].ea <= ea) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo == 0 ? prof.sym_count : lo - 1;
+}
+
+/*
+ * Symbol name, or the page for addresses without one.
+ */
+static const char *
+prof_name(gea_t ea,
+          char *buf,
+          length_t size)
+{
+  count_t i = prof_sym_find(ea);
+
+  if (i != prof.sym_count) {
+    return prof.syms[i].name;
+  }
+
+  snprintf(buf, size, "0x%08x", ea & ~PAGE_MASK);
+  return buf;
+}
+
+typedef struct {
+  gea_t key;
+  uint64_t count;
+} prof_bin_t;
+
+static int
+prof_bin_key_cmp(const void *a,
+                 const void *b)
+{
+  const prof_bin_t *x = a;
+  const prof_bin_t *y = b;
+
+  return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static int
+prof_bin_count_cmp(const void *a,
+                   const void *b)
+{
+  const prof_bin_t *x = a;
+  const prof_bin_t *y = b;
+
+  return x->count > y->count ? -1 : x->count < y->count;
+}
+
+/*
+ * Samples by page, or by symbol (and by page outside of
+ * any symbol), busiest first.
+ */
+void
+prof_top(count_t count,
+         bool pages)
+{
+  unsigned i;
+  count_t bins = 0;
+  prof_bin_t *bin;
+  char buf[16];
+
+  if (prof.used == 0) {
+    mon_printf("no samples\n");
+    return;
+  }
+
+  bin = malloc(prof.used * sizeof(prof_bin_t));
+  if (bin == NULL) {
+    mon_printf("%s\n", err_to_string(ERR_NO_MEM));
+    return;
+  }
+
+  for (i = 0; i < PROF_SLOTS; i++) {
+    prof_slot_t *s = prof.slots + i;
+
+    if (s->count == 0) {
+      continue;
+    }
+
+    bin[bins].key = s->pc & ~PAGE_MASK;
+    if (!pages) {
+      count_t sym = prof_sym_find(s->pc);
+
+      if (sym != prof.sym_count) {
+        bin[bins].key = prof.syms[sym].ea;
+      }
+    }
+    bin[bins].count = s->count;
+    bins++;
+  }
+
+  qsort(bin, bins, sizeof(prof_bin_t), prof_bin_key_cmp);
+  for (i = 1; i < bins; i++) {
+    if (bin[i].key == bin[i - 1].key) {
+      bin[i].count += bin[i - 1].count;
+      bin[i - 1].count = 0;
+    }
+  }
+  qsort(bin, bins, sizeof(prof_bin_t), prof_bin_count_cmp);
+
+  for (i = 0; i < min(count, bins) && bin[i].count != 0; i++) {
+    mon_printf("%10llu %5.1f%% 0x%08x %s\n", bin[i].count,
+               bin[i].count * 100.0 / prof.samples, bin[i].key,
+               pages ? "" : prof_name(bin[i].key, buf, sizeof(buf)));
+  }
+
+  free(bin);
+}
+
+/*
+ * Folded stacks of caller;callee for flamegraph.pl, the
+ * caller being whatever LR points into. LR is only a good
+ * guess at the caller for leaf functions.
+ */
+err_t
+prof_folded(const char *path)
+{
+  FILE *f;
+  unsigned i;
+  char pc_buf[16];
+  char lr_buf[16];
+
+  f = fopen(path, "w");
+  if (f == NULL) {
+    POSIX_ERROR(errno, "could not create '%s'", path);
+    return ERR_POSIX;
+  }
+
+  for (i = 0; prof.slots != NULL && i < PROF_SLOTS; i++) {
+    prof_slot_t *s = prof.slots + i;
+
+    if (s->count != 0) {
+      fprintf(f, "%s;%s %llu\n",
+              prof_name(s->lr, lr_buf, sizeof(lr_buf)),
+              prof_name(s->pc, pc_buf, sizeof(pc_buf)),
+              s->count);
+    }
+  }
+
+  fclose(f);
+  return ERR_NONE;
+}
+
+void
+prof_mon_dump(void)
+{
+  mon_printf("%s, %llu samples (%llu dropped), %u distinct, %u symbols\n",
+             prof.running ? "running" : "stopped", prof.samples,
+             prof.dropped, prof.used, prof.sym_count);
+}
+
+void
+prof_bye(void)
+{
+  prof_stop();
+  if (prof.samples != 0) {
+    LOG("%llu samples (%llu dropped)", prof.samples, prof.dropped);
+  }
+
+  free(prof.slots);
+  free(prof.syms);
+}
@@ -0,0 +1,191 @@
+/*
+ * Paravirtual console, see pvcon.h for the interface.
+ *
+ * Compared to an OF "write", this skips the CIA decoding
+ * and the per-character translation, and the ring variant
+ * skips the exits altogether until the ring fills up.
+ */
+
+#define LOG_PFX PVCON
+#include "pvcon.h"
+#include "guest.h"
+#include "pmem.h"
+#include "term.h"
+#include "mon.h"
+
+#define CHUNK_SIZE PAGE_SIZE
+
+static gra_t trampoline = -1;
+static gra_t ring_ra;
+static length_t ring_size;
+static uint64_t calls;
+static uint64_t kicks;
+static uint64_t write_bytes;
+static uint64_t ring_bytes;
+
+err_t
+pvcon_init(gra_t tramp)
+{
+  uint32_t hvcall = 0x44000022; /* sc 1 */
+
+  if (pmem_to(tramp, &hvcall, sizeof(hvcall), 4) != sizeof(hvcall)) {
+    return ERR_BAD_ACCESS;
+  }
+
+  trampoline = tramp;
+  return ERR_NONE;
+}
+
+static length_t
+pvcon_write(gea_t ea,
+            length_t len)
+{
+  char buf[CHUNK_SIZE];
+  length_t done = 0;
+
+  while (done != len) {
+    length_t chunk = min(len - done, (length_t) CHUNK_SIZE);
+    length_t xferred = guest_from_ex(buf, ea + done, chunk, 1, false);
+
+    term_out(buf, xferred);
+    done += xferred;
+    if (xferred != chunk) {
+      break;
+    }
+  }
+
+  term_flush();
+  write_bytes += done;
+  return done;
+}
+
+static void
+pvcon_drain(void)
+{
+  pvcon_ring_t r;
+  length_t size = ring_size;
+  gra_t data = ring_ra + sizeof(pvcon_ring_t);
+  length_t count;
+
+  if (pmem_from_x(&r.head, ring_ra + offsetof(pvcon_ring_t, head)) != ERR_NONE ||
+      pmem_from_x(&r.tail, ring_ra + offsetof(pvcon_ring_t, tail)) != ERR_NONE) {
+    return;
+  }
+
+  count = r.head - r.tail;
+  if (count == 0) {
+    return;
+  }
+
+  if (count > size) {
+    WARN("bogus ring head 0x%x tail 0x%x, resyncing", r.head, r.tail);
+    count = 0;
+  }
+
+  while (count != 0) {
+    char buf[CHUNK_SIZE];
+    length_t pos = r.tail % size;
+    length_t chunk = min(count, size - pos);
+
+    chunk = min(chunk, (length_t) sizeof(buf));
+    pmem_from(buf, data + pos, chunk, 1);
+    term_out(buf, chunk);
+    r.tail += chunk;
+    count -= chunk;
+    ring_bytes += chunk;
+  }
+
+  r.tail = r.head;
+  pmem_to(ring_ra + offsetof(pvcon_ring_t, tail), &r.tail,
+          sizeof(r.tail), sizeof(r.tail));
+  term_flush();
+}
+
+static uint32_t
+pvcon_ring(gra_t ra,
+           length_t size)
+{
+  if (ring_size != 0) {
+    pvcon_drain();
+    ring_size = 0;
+  }
+
+  if (ra == 0) {
+    return 0;
+  }
+
+  /*
+   * Data size is a power of two, so the free-running
+   * head and tail wrap cleanly.
+   */
+  if (size == 0 || (size & (size - 1)) != 0 ||
+      (ra & (sizeof(uint32_t) - 1)) != 0 ||
+      !pmem_gra_valid(ra) ||
+      !pmem_gra_valid(ra + sizeof(pvcon_ring_t) + size - 1)) {
+    WARN("bad ring 0x%x size 0x%x", ra, size);
+    return -1;
+  }
+
+  ring_ra = ra;
+  ring_size = size;
+  LOG("ring at 0x%x, %u bytes", ra, size);
+  return 0;
+}
+
+err_t
+pvcon_call(void)
+{
+  gra_t pc;
+  err_t err;
+  vmm_regs32_t *r = guest->regs;
+
+  err = guest_backmap(r->ppcPC, &pc);
+  if (err != ERR_NONE || pc != trampoline + 4) {
+    return ERR_NOT_ROM_CALL;
+  }
+
+  calls++;
+  switch (r->ppcGPRs[3]) {
+  case PVCON_WRITE:
+    r->ppcGPRs[3] = pvcon_write(r->ppcGPRs[4], r->ppcGPRs[5]);
+    break;
+  case PVCON_RING:
+    r->ppcGPRs[3] = pvcon_ring(r->ppcGPRs[4], r->ppcGPRs[5]);
+    break;
+  case PVCON_KICK:
+    kicks++;
+    if (ring_size != 0) {
+      pvcon_drain();
+    }
+    r->ppcGPRs[3] = 0;
+    break;
+  default:
+    WARN("unknown function %lu", r->ppcGPRs[3]);
+    r->ppcGPRs[3] = -1;
+    break;
+  }
+
+  r->ppcPC = r->ppcLR;
+  return ERR_NONE;
+}
+
+void
+pvcon_poll(void)
+{
+  if (ring_size != 0) {
+    pvcon_drain();
+  }
+}
+
+void
+pvcon_mon_dump(void)
+{
+  mon_printf("pvcon:\n");
+  mon_printf("  trampoline 0x%x, %llu calls, %llu kicks\n",
+             trampoline, calls, kicks);
+  mon_printf("  %llu bytes written, %llu bytes through ring\n",
+             write_bytes, ring_bytes);
+  if (ring_size != 0) {
+    mon_printf("  ring at 0x%x, %u bytes\n", ring_ra, ring_size);
+  }
+}
@@ -3,13 +3,37 @@
 #include "rom.h"
 #include "ppc-defs.h"
 #include "term.h"
+#include "socket.h"
 #include "mon.h"
 #include "disk.h"
+#include "fs.h"
+#include "io.h"
+#include "mmio.h"
+#include "conlog.h"
+#include "pvcon.h"
+#include "bp.h"
+#include "gdb.h"
+#include "stats.h"
+#include "etrace.h"
+#include "prof.h"
 
 #define ENTER_MON_MSG "waiting for monitor"
 
 static bool cpu_little_endian = false;
 const char *fdt_path = "pvp.dtb";
+static bool headless = false;
+static const char *console_log_path = NULL;
+static const char *console_script_path = NULL;
+static const char *console_sock_path = NULL;
+static const char *mon_sock_path = NULL;
+static const char *gdb_sock_path = NULL;
+static const char *conlog_path = NULL;
+static length_t conlog_size = MB(1);
+static length_t console_in_size = 0;
+static const char *record_path = NULL;
+static const char *replay_path = NULL;
+static const char *etrace_path = NULL;
+static count_t etrace_entries = 65536;
 
 void
 usage(int argc, char **argv)
@@ -19,7 +43,7 @@ usage(int argc, char **argv)
   while (1) {
     int c;
     opterr = 0;
-    c = getopt(argc, argv, "F:L");
+    c = getopt(argc, argv, "F:Ld:D:Ho:i:u:U:g:c:C:r:R:P:t:T:");
     if (c == -1) {
       break;
     } else if (c == '?') {
@@ -34,6 +58,62 @@ usage(int argc, char **argv)
     case 'L':
       cpu_little_endian = true;
       break;
+    case 'd':
+    case 'D':
+      if (rom_add_disk(optarg, c == 'D') != ERR_NONE) {
+        exit(1);
+      }
+      break;
+    case 'H':
+      headless = true;
+      break;
+    case 'o':
+      console_log_path = optarg;
+      break;
+    case 'i':
+      console_script_path = optarg;
+      break;
+    case 'u':
+      console_sock_path = optarg;
+      break;
+    case 'U':
+      mon_sock_path = optarg;
+      break;
+    case 'g':
+      gdb_sock_path = optarg;
+      break;
+    case 'c':
+      conlog_path = optarg;
+      break;
+    case 'C':
+      conlog_size = strtoul(optarg, NULL, 0) * 1024;
+      if (conlog_size == 0) {
+        do_help = true;
+      }
+      break;
+    case 'r':
+      console_in_size = strtoul(optarg, NULL, 0);
+      if (console_in_size == 0 ||
+          console_in_size > SOCKET_IN_MAX / 1024) {
+        do_help = true;
+      }
+      console_in_size *= 1024;
+      break;
+    case 'R':
+      record_path = optarg;
+      break;
+    case 'P':
+      replay_path = optarg;
+      break;
+    case 't':
+      etrace_path = optarg;
+      break;
+    case 'T':
+      etrace_entries = strtoul(optarg, NULL, 0);
+      if (etrace_entries == 0) {
+        do_help = true;
+      }
+      break;
     }
   }
 
@@ -41,7 +121,13 @@ usage(int argc, char **argv)
     return;
   }
   
-  fprintf(stderr, "Usage: %s [-L] [-F fdt.dtb]\n", argv[0]);
+  fprintf(stderr, "Usage: %s [-L] [-F fdt.dtb] [-d disk.img] [-D ro-disk.img]\n"
+          "          [-H] [-o console.log] [-i console-input.txt]\n"
+          "          [-u console.sock] [-U monitor.sock] [-g gdb.sock]\n"
+          "          [-c capture.bin] [-C capture-KiB] [-r input-KiB]\n"
+          "          [-R record.txt] [-P replay.txt]\n"
+          "          [-t trace.bin] [-T trace-entries]\n",
+          argv[0]);
   exit(1);
 }
    
@@ -55,21 +141,55 @@ main(int argc, char **argv)
   err = guest_init(cpu_little_endian, MB(32));
   ON_ERROR("guest_init", err, out);
 
-  err = term_init();
+  err = io_init();
+  ON_ERROR("io_init", err, out);
+
+  if (conlog_path != NULL) {
+    err = conlog_init(conlog_path, conlog_size);
+    ON_ERROR("conlog_init", err, out);
+  }
+
+  err = term_init(headless, console_log_path, console_script_path,
+                  console_sock_path, console_in_size);
   ON_ERROR("term_init", err, out);
 
+  err = term_record(record_path, replay_path);
+  ON_ERROR("term_record", err, out);
+
   err = rom_init(fdt_path);
   ON_ERROR("rom_init", err, out);
 
-  err = mon_init();
+  if (etrace_path != NULL) {
+    err = etrace_init(etrace_path, etrace_entries);
+    ON_ERROR("etrace_init", err, out);
+  }
+
+  err = mon_init(mon_sock_path);
   ON_ERROR("mon_init", err, out);
+
+  err = gdb_init(gdb_sock_path);
+  ON_ERROR("gdb_init", err, out);
+
+  stats_init();
    
   LOG("Switching to guest virtual machine TI 0x%x",
       guest->vmm->thread_index);
   while (1) {
+    uint64_t exit_start;
     vmm_return_code_t vmm_ret;
 
     vmm_ret = vmm_call(kVmmExecuteVM, guest->vmm->thread_index);
+    exit_start = hist_time_ns();
+    /*
+     * Exits that go to unhandled without an error of their
+     * own mustn't report the one from the last stop.
+     */
+    err = ERR_NONE;
+    guest->exits++;
+    if (vmm_ret != kVmmReturnNull) {
+      guest->own_exits++;
+    }
+    guest->exit_pc = guest->regs->ppcPC;
     switch (vmm_ret) {
     case kVmmReturnNull:
       break;
@@ -87,12 +207,18 @@ main(int argc, char **argv)
     case kVmmReturnAlignmentFault:
       goto unhandled;
     case kVmmReturnProgramException:
-      err = guest_emulate();
+      err = bp_program();
+      if (err == ERR_NOT_FOUND) {
+        err = guest_emulate();
+      }
       if (err != ERR_NONE) {
         goto unhandled;
       }
       break;
     case kVmmReturnTraceException:
+      if (bp_trace()) {
+        break;
+      }
       goto unhandled;
     case kVmmAltivecAssist:
       goto unhandled;
@@ -100,6 +226,9 @@ main(int argc, char **argv)
       goto unhandled;
     case kVmmReturnSystemCall:
       err = rom_call();
+      if (err == ERR_NOT_ROM_CALL) {
+        err = pvcon_call();
+      }
       if (err == ERR_SHUTDOWN) {
         goto stop;
       } else if (err != ERR_NONE) {
@@ -112,6 +241,13 @@ main(int argc, char **argv)
       goto unhandled;
     }
 
+    stats_exit(vmm_ret, exit_start);
+    etrace_exit(vmm_ret, exit_start);
+    prof_exit();
+    exit_start = 0;
+    mmio_sync();
+    pvcon_poll();
+
     err = mon_trace();
     if (err == ERR_SHUTDOWN) {
       goto stop;
@@ -128,8 +264,27 @@ main(int argc, char **argv)
       goto unhandled;
     }
 
+    err = gdb_check();
+    if (err != ERR_NONE) {
+      goto unhandled;
+    }
+
     continue;
   unhandled:
+    if (exit_start != 0) {
+      stats_exit(vmm_ret, exit_start);
+      etrace_exit(vmm_ret, exit_start);
+      prof_exit();
+    }
+    mmio_sync();
+    if (gdb_connected()) {
+      if (gdb_activate(err, vmm_ret) != ERR_NONE) {
+        break;
+      }
+      bp_resume();
+      continue;
+    }
+
     if (err != ERR_NONE) {
       ERROR(err, ENTER_MON_MSG);
     } else if (vmm_ret != kVmmReturnNull) {
@@ -138,14 +293,22 @@ main(int argc, char **argv)
     if (mon_activate() != ERR_NONE) {
       break;
     }
+    bp_resume();
   }
  stop:
 
   LOG("Requested VM stop");
   guest_bye();
+  fs_bye();
   disk_bye();
+  io_bye();
   term_bye();
+  conlog_bye();
   mon_bye();
+  gdb_bye();
+  stats_bye();
+  etrace_bye();
+  prof_bye();
 
 out:
   if (err == ERR_NONE) {
@@ -16,6 +16,11 @@
 #include "list.h"
 #include "mon.h"
 #include "disk.h"
+#include "fs.h"
+#include "mmio.h"
+#include "stats.h"
+#include "uart.h"
+#include "pvcon.h"
 
 #include <fcntl.h>
 #include <errno.h>
@@ -23,6 +28,10 @@
 #include <sys/time.h>
 
 #define PHANDLE_MUNGE 0x10000000
+#define FDT_SLACK     PAGE_SIZE
+#define MAX_EXTRA_DISKS 16
+#define PVCON_TRAMPOLINE 0x8
+#define DISK_PARENT   "/fake-storage"
 #define ROOT_PHANDLE rom_get_phandle(0)
 #define CELL(x, i) (x + i * sizeof(cell_t))
 #define CIA_SERVICE CELL(cia, 0)
@@ -58,6 +67,16 @@ static gra_t stack_end;
 
 static uint8_t xfer_buf[PAGE_SIZE];
 
+/*
+ * Disks given on the command line, injected into
+ * the DT as DISK_PARENT/diskN, aliased as hdN.
+ */
+static struct {
+  const char *path;
+  bool read_only;
+} extra_disks[MAX_EXTRA_DISKS];
+static unsigned extra_disk_count;
+
 struct ihandle_methods;
 typedef count_t (*ihandle_write_t)(struct ihandle_methods *im,
                                    const uint8_t *b, count_t len);
@@ -66,12 +85,20 @@ typedef count_t (*ihandle_read_t)(struct ihandle_methods *im,
 typedef err_t (*ihandle_seek_t)(struct ihandle_methods *im,
                                 offset_t offset);
 typedef void (*ihandle_close_t)(struct ihandle_methods *im);
+/*
+ * Optional. Like read, but instead of copying returns a pointer
+ * to up to *len bytes of backing data, which rom_read can copy
+ * straight into guest memory.
+ */
+typedef const uint8_t *(*ihandle_read_map_t)(struct ihandle_methods *im,
+                                             count_t *len);
 
 typedef struct ihandle_methods {
   ihandle_write_t write;
   ihandle_read_t read;
   ihandle_seek_t seek;
   ihandle_close_t close;
+  ihandle_read_map_t read_map;
 } ihandle_methods_t;
 
 typedef enum ihandle_type {
@@ -79,6 +106,7 @@ typedef enum ihandle_type {
   IHANDLE_WRAPPED,
   IHANDLE_FILE,
   IHANDLE_DISK,
+  IHANDLE_FS,
 } ihandle_type_t;
 
 typedef struct ihandle_header {
@@ -100,8 +128,17 @@ typedef struct ihandle_disk {
   disk_part_t part;
   offset_t current_off;
   char *path;
+  disk_io_stats_t stats;
 } ihandle_disk_t;
 
+typedef struct ihandle_fs {
+  ihandle_header_t header;
+  fs_file_t *file;
+  offset_t current_off;
+  char *path;
+  disk_io_stats_t stats;
+} ihandle_fs_t;
+
 typedef struct {
   err_t (*handler)(gea_t cia, count_t cia_in,
                    count_t cia_out);
@@ -173,6 +210,17 @@ rom_mon_dump_known_ihandles(void)
 
       mon_printf("0x%08x: disk (path = '%s')\n",
                  header->value, d->path);
+      disk_io_stats_format(&d->stats, (char *) xfer_buf, sizeof(xfer_buf));
+      mon_printf("            %s\n", xfer_buf);
+      break;
+    }
+    case IHANDLE_FS: {
+      ihandle_fs_t *f = container_of(header, ihandle_fs_t, header);
+
+      mon_printf("0x%08x: fs file (size 0x%x, path = '%s')\n",
+                 header->value, fs_size(f->file), f->path);
+      disk_io_stats_format(&f->stats, (char *) xfer_buf, sizeof(xfer_buf));
+      mon_printf("            %s\n", xfer_buf);
       break;
     }
     case IHANDLE_BOGUS:
@@ -217,6 +265,7 @@ rom_wrap_ihandle_with_methods(ihandle_t t,
   h->methods.read = read;
   h->methods.seek = seek;
   h->methods.close = close;
+  h->methods.read_map = NULL;
   list_add_tail(&h->link, &known_ihandles);
   return ERR_NONE;
 }
@@ -293,6 +342,9 @@ rom_disk_seek(ihandle_methods_t *im,
     return ERR_OUT_OF_BOUNDS;
   }
 
+  if (offset != d->current_off) {
+    d->stats.seeks++;
+  }
   d->current_off = offset;
   return ERR_NONE;
 }
@@ -313,10 +365,28 @@ rom_disk_read(ihandle_methods_t *im,
 
   len = min(len, d->part.length - d->current_off);
   c = disk_in(d->disk, s, len);
+  disk_io_account(&d->stats, false, d->current_off, c);
   d->current_off += c;
   return c;
 }
 
+static const uint8_t *
+rom_disk_read_map(ihandle_methods_t *im,
+                  count_t *len)
+{
+  const uint8_t *p;
+  ihandle_header_t *h = container_of(im, ihandle_header_t, methods);
+  ihandle_disk_t *d = container_of(h, ihandle_disk_t, header);
+
+  *len = min(*len, d->part.length - d->current_off);
+  p = disk_map_at(d->disk, d->part.off + d->current_off, len);
+  if (p != NULL) {
+    disk_io_account(&d->stats, false, d->current_off, *len);
+  }
+  d->current_off += *len;
+  return p;
+}
+
 static count_t
 rom_disk_write(ihandle_methods_t *im,
                const uint8_t *s,
@@ -333,6 +403,7 @@ rom_disk_write(ihandle_methods_t *im,
 
   len = min(len, d->part.length - d->current_off);
   c = disk_out(d->disk, s, len);
+  disk_io_account(&d->stats, true, d->current_off, c);
   d->current_off += c;
   return c;
 }
@@ -349,6 +420,78 @@ rom_disk_close(struct ihandle_methods *im)
   free(d);
 }
 
+static err_t
+rom_fs_seek(ihandle_methods_t *im,
+            offset_t offset)
+{
+  ihandle_header_t *h = container_of(im, ihandle_header_t, methods);
+  ihandle_fs_t *f = container_of(h, ihandle_fs_t, header);
+
+  if (offset > fs_size(f->file)) {
+    return ERR_OUT_OF_BOUNDS;
+  }
+
+  if (offset != f->current_off) {
+    f->stats.seeks++;
+  }
+  f->current_off = offset;
+  return ERR_NONE;
+}
+
+static count_t
+rom_fs_read(ihandle_methods_t *im,
+            uint8_t *s,
+            count_t len)
+{
+  length_t c;
+  ihandle_header_t *h = container_of(im, ihandle_header_t, methods);
+  ihandle_fs_t *f = container_of(h, ihandle_fs_t, header);
+
+  c = fs_read(f->file, f->current_off, s, len);
+  disk_io_account(&f->stats, false, f->current_off, c);
+  f->current_off += c;
+  return c;
+}
+
+static const uint8_t *
+rom_fs_read_map(ihandle_methods_t *im,
+                count_t *len)
+{
+  const uint8_t *p;
+  ihandle_header_t *h = container_of(im, ihandle_header_t, methods);
+  ihandle_fs_t *f = container_of(h, ihandle_fs_t, header);
+
+  p = fs_map_at(f->file, f->current_off, len);
+  if (p != NULL) {
+    disk_io_account(&f->stats, false, f->current_off, *len);
+    f->current_off += *len;
+  }
+  return p;
+}
+
+static count_t
+rom_fs_write(ihandle_methods_t *im,
+             const uint8_t *s,
+             count_t len)
+{
+  /*
+   * File systems are read-only.
+   */
+  return 0;
+}
+
+static void
+rom_fs_close(struct ihandle_methods *im)
+{
+  ihandle_header_t *h = container_of(im, ihandle_header_t, methods);
+  ihandle_fs_t *f = container_of(h, ihandle_fs_t, header);
+
+  fs_close(f->file);
+  list_del(&h->link);
+  free(f->path);
+  free(f);
+}
+
 static err_t
 rom_ihandle_from_file(const char *path,
                       const char *full_path,
@@ -380,6 +523,7 @@ rom_ihandle_from_file(const char *path,
   f->header.methods.read = rom_file_read;
   f->header.methods.seek = rom_file_seek;
   f->header.methods.close = rom_file_close;
+  f->header.methods.read_map = NULL;
   f->fd = fd;
   f->path = dup_path;
   list_add_tail(&f->header.link, &known_ihandles);
@@ -413,14 +557,52 @@ rom_ihandle_from_disk(disk_t *disk,
   d->header.methods.read = rom_disk_read;
   d->header.methods.seek = rom_disk_seek;
   d->header.methods.close = rom_disk_close;
+  d->header.methods.read_map = rom_disk_read_map;
   d->path = dup_path;
   d->disk = disk;
   d->part = *part;
+  d->current_off = 0;
+  memset(&d->stats, 0, sizeof(d->stats));
   list_add_tail(&d->header.link, &known_ihandles);
   *ihandle = d->header.value;
   return ERR_NONE;
 }
 
+static err_t
+rom_ihandle_from_fs(fs_file_t *file,
+                    const char *full_path,
+                    ihandle_t *ihandle)
+{
+  ihandle_fs_t *f;
+  char *dup_path;
+
+  f = malloc(sizeof(ihandle_fs_t));
+  if (f == NULL) {
+    return ERR_NO_MEM;
+  }
+
+  dup_path = strdup(full_path);
+  if (dup_path == NULL) {
+    free(f);
+    return ERR_NO_MEM;
+  }
+
+  f->header.type = IHANDLE_FS;
+  f->header.value = (ihandle_t) f;
+  f->header.methods.write = rom_fs_write;
+  f->header.methods.read = rom_fs_read;
+  f->header.methods.seek = rom_fs_seek;
+  f->header.methods.close = rom_fs_close;
+  f->header.methods.read_map = rom_fs_read_map;
+  f->file = file;
+  f->current_off = 0;
+  memset(&f->stats, 0, sizeof(f->stats));
+  f->path = dup_path;
+  list_add_tail(&f->header.link, &known_ihandles);
+  *ihandle = f->header.value;
+  return ERR_NONE;
+}
+
 static uint32_t
 rom_claim_ex(uint32_t addr,
              uint32_t size,
@@ -600,7 +782,7 @@ rom_mmu_call(gea_t cia,
     return ERR_NONE;
   }
 
-  if (!pmem_gra_valid(phys)) {
+  if (!pmem_gra_valid(phys) && !mmio_page(phys)) {
     return ERR_BAD_ACCESS;
   }
 
@@ -614,6 +796,108 @@ rom_mmu_call(gea_t cia,
   return err;
 }
 
+static int
+rom_cells(int node,
+          const char *name,
+          int def)
+{
+  const cell_t *p = fdt_getprop(fdt, node, name, NULL);
+
+  if (p == NULL) {
+    return def;
+  }
+
+  return be32_to_cpu(*p);
+}
+
+/*
+ * Translates the first reg entry of a node into a CPU physical
+ * address by walking up through the parent ranges. Only the
+ * last address cell is treated as an offset, which is plenty
+ * for ISA and PCI I/O space.
+ */
+static err_t
+rom_reg_to_phys(int node,
+                gra_t *pa)
+{
+  int i;
+  int parent;
+  int ac;
+  const cell_t *reg;
+  cell_t addr[4];
+  int len;
+
+  parent = fdt_parent_offset(fdt, node);
+  if (parent < 0) {
+    return ERR_NOT_FOUND;
+  }
+
+  ac = rom_cells(parent, "#address-cells", 2);
+  reg = fdt_getprop(fdt, node, "reg", &len);
+  if (reg == NULL || ac > ARRAY_LEN(addr) ||
+      len < ac * sizeof(cell_t)) {
+    return ERR_NOT_FOUND;
+  }
+  for (i = 0; i < ac; i++) {
+    addr[i] = be32_to_cpu(reg[i]);
+  }
+
+  for (node = parent; node != 0; node = parent) {
+    const cell_t *r;
+    int pac;
+    int sc;
+    int entry;
+    bool pci;
+    bool found = false;
+
+    parent = fdt_parent_offset(fdt, node);
+    BUG_ON(parent < 0, "couldn't find parent");
+    pac = rom_cells(parent, "#address-cells", 2);
+    sc = rom_cells(node, "#size-cells", 1);
+    r = fdt_getprop(fdt, node, "ranges", &len);
+    if (r == NULL || pac > ARRAY_LEN(addr)) {
+      return ERR_NOT_FOUND;
+    }
+
+    /*
+     * PCI phys.hi also encodes the device and register,
+     * only the address space type is matched.
+     */
+    pci = fdt_node_check_dtype(fdt, node, "pci") == 0;
+    entry = ac + pac + sc;
+    for (; len >= entry * (int) sizeof(cell_t);
+         len -= entry * sizeof(cell_t), r += entry) {
+      cell_t off;
+      cell_t size = be32_to_cpu(r[ac + pac + sc - 1]);
+
+      for (i = 0; i < ac - 1; i++) {
+        cell_t mask = (pci && i == 0) ? 0x03000000 : 0xffffffff;
+        if ((addr[i] & mask) != (be32_to_cpu(r[i]) & mask)) {
+          break;
+        }
+      }
+
+      off = addr[ac - 1] - be32_to_cpu(r[ac - 1]);
+      if (i == ac - 1 && off < size) {
+        for (i = 0; i < pac; i++) {
+          addr[i] = be32_to_cpu(r[ac + i]);
+        }
+        addr[pac - 1] += off;
+        found = true;
+        break;
+      }
+    }
+
+    if (!found) {
+      return ERR_NOT_FOUND;
+    }
+    ac = pac;
+  }
+
+  *pa = addr[ac - 1];
+  return ERR_NONE;
+}
+
 static err_t
 rom_callmethod(gea_t cia,
                count_t cia_in,
@@ -664,26 +948,90 @@ rom_console_write(ihandle_methods_t *im,
                   const uint8_t *s,
                   count_t len)
 {
-  while (len--) {
-    if (*s == 0x9b) {
-      term_out("\33[", 2);
-    } else if (*s == 0xcd) {
-      term_out("=", 1);
-    } else if (*s == 0xba) {
-      term_out("|", 1);
-    } else if (*s == 0xbb ||
-               *s == 0xc8) {
-      term_out("\\", 1);
-    } else if (*s == 0xbc ||
-               *s == 0xc9) {
-      term_out("/", 1);
-    } else {
-      term_out((const char *) s, 1);
+  term_out_xlat(s, len);
+  term_flush();
+
+  return len;
+}
+
+err_t
+rom_add_disk(const char *path,
+             bool read_only)
+{
+  if (extra_disk_count == ARRAY_LEN(extra_disks)) {
+    ERROR(ERR_NO_MEM, "too many disks, can't add '%s'", path);
+    return ERR_NO_MEM;
+  }
+
+  extra_disks[extra_disk_count].path = path;
+  extra_disks[extra_disk_count].read_only = read_only;
+  extra_disk_count++;
+  return ERR_NONE;
+}
+
+static err_t
+rom_inject_disks(void)
+{
+  int ret;
+  int node;
+  unsigned i;
+  char name[32];
+  char path[64];
+
+  for (i = 0; i < extra_disk_count; i++) {
+    snprintf(name, sizeof(name), "disk%u", i + 1);
+    snprintf(path, sizeof(path), DISK_PARENT "/%s", name);
+
+    node = fdt_path_offset(fdt, DISK_PARENT);
+    if (node < 0) {
+      ret = node;
+      goto fdt_err;
+    }
+
+    node = fdt_add_subnode(fdt, node, name);
+    if (node < 0) {
+      ret = node;
+      goto fdt_err;
+    }
+
+    ret = fdt_setprop_string(fdt, node, "disk_file",
+                             extra_disks[i].path);
+    if (ret < 0) {
+      goto fdt_err;
+    }
+
+    ret = fdt_setprop_string(fdt, node, "device_type", "block");
+    if (ret < 0) {
+      goto fdt_err;
     }
-    s++;
+
+    if (extra_disks[i].read_only) {
+      ret = fdt_setprop(fdt, node, "read-only", NULL, 0);
+      if (ret < 0) {
+        goto fdt_err;
+      }
+    }
+
+    node = fdt_path_offset(fdt, "/aliases");
+    if (node < 0) {
+      ret = node;
+      goto fdt_err;
+    }
+
+    snprintf(name, sizeof(name), "hd%u", i + 1);
+    ret = fdt_setprop_string(fdt, node, name, path);
+    if (ret < 0) {
+      goto fdt_err;
+    }
+
+    LOG("%s%s is %s", extra_disks[i].path,
+        extra_disks[i].read_only ? " (read-only)" : "", name);
   }
 
-  return len;
+  return ERR_NONE;
+ fdt_err:
+  FDT_ERROR(ret, "couldn't add disk '%s'", extra_disks[i].path);
+  return ERR_NO_MEM;
 }
 
 err_t
@@ -700,6 +1048,7 @@ rom_init(const char *fdt_path)
   void *loader_data;
   gea_t stack_base;
   ihandle_t console_ihandle;
+  gra_t uart_base;
   err_t err = ERR_NONE;
 
   BUG_ON(pmem_size() <= MB(16), "guest RAM too small");
@@ -772,7 +1121,7 @@ rom_init(const char *fdt_path)
   ret = fstat(fd, &st);
   ON_POSIX_ERROR("fdt stat", ret, posix_err);
 
-  fdt = malloc(st.st_size);
+  fdt = malloc(st.st_size + FDT_SLACK);
   if (fdt == NULL) {
     ERROR(errno, "couldn't alloc %u bytes to read fdt", st.st_size);
     goto posix_err;
@@ -782,6 +1131,16 @@ rom_init(const char *fdt_path)
   ON_POSIX_ERROR("fdt read", ret, posix_err);
   close(fd);
 
+  ret = fdt_open_into(fdt, fdt, st.st_size + FDT_SLACK);
+  if (ret < 0) {
+    FDT_ERROR(ret, "'%s' is not a usable DT template", fdt_path);
+    err = ERR_UNSUPPORTED;
+    goto done;
+  }
+
+  err = rom_inject_disks();
+  ON_ERROR("rom_inject_disks", err, done);
+
   memory_node = fdt_path_offset(fdt, "mem");
   BUG_ON(memory_node == -1, "memory node missing from DT template");
   memory_ihandle = rom_get_ihandle(memory_node);
@@ -792,6 +1151,19 @@ rom_init(const char *fdt_path)
   console_ihandle = rom_path_to_ihandle("con");
   BUG_ON(console_ihandle == -1, "console node missing from DT template");
 
+  /*
+   * The same serial port is emulated for OSes
+   * that stop using the CIF console.
+   */
+  err = rom_reg_to_phys(rom_node_offset_by_ihandle(console_ihandle),
+                        &uart_base);
+  if (err == ERR_NONE) {
+    err = uart_init(uart_base);
+    ON_ERROR("uart_init", err, done);
+  } else {
+    WARN("couldn't translate console reg, no UART");
+  }
+
   err = rom_wrap_ihandle_with_methods(console_ihandle,
                                       rom_console_write,
                                       rom_console_read,
@@ -805,6 +1177,21 @@ rom_init(const char *fdt_path)
   pmem_to(cif_trampoline, &hvcall, sizeof(hvcall), 4);
   rom_claim_ex(cif_trampoline, sizeof(hvcall), 0);
 
+  /*
+   * PV console entry, right after.
+   */
+  err = pvcon_init(PVCON_TRAMPOLINE);
+  ON_ERROR("pvcon_init", err, done);
+  rom_claim_ex(PVCON_TRAMPOLINE, sizeof(hvcall), 0);
+
+  ret = fdt_setprop_cell(fdt, rom_node_offset_by_ihandle(console_ihandle),
+                         "pvp,hcall", PVCON_TRAMPOLINE);
+  if (ret < 0) {
+    FDT_ERROR(ret, "couldn't advertise PV console");
+    err = ERR_NO_MEM;
+    goto done;
+  }
+
   /*
    * Stack.
    */
@@ -1326,7 +1713,8 @@ rom_open_parse_path(char *path, ihandle_t *ihandle)
   char *f;
   int node;
   err_t err;
-  disk_t *disk;
+  bool read_only;
+  disk_t *disk = NULL;
   const char *disk_path;
   disk_part_t part;
   char *dev = strdup(path);
@@ -1347,18 +1735,12 @@ rom_open_parse_path(char *path, ihandle_t *ihandle)
     p++;
   }
 
-  if (f != NULL) {
-    /*
-     * Temporary, while we don't have own FS
-     * handler, read from outside.
-     */
-    err = rom_ihandle_from_file(f, path, ihandle);
-    free(dev);
-    return err;
-  }
-
   node = fdt_path_offset(fdt, dev);
   if (node < 0) {
+    if (f != NULL) {
+      goto host_file;
+    }
+
     WARN("dev '%s' not found", dev);
     err = ERR_NOT_FOUND;
     goto done;
@@ -1366,23 +1748,65 @@ rom_open_parse_path(char *path, ihandle_t *ihandle)
 
   disk_path = fdt_getprop(fdt, node, "disk_file", NULL);
   if (disk_path == NULL) {
+    if (f != NULL) {
+      goto host_file;
+    }
+
     WARN("dev '%s' inappropriate device", dev);
     err = ERR_UNSUPPORTED;
     goto done;
   }
 
-  disk = disk_open(disk_path);
+  /*
+   * Read-only disks (install media, golden images) are
+   * mmap()ed instead of going through lseek+read.
+   */
+  read_only = fdt_getprop(fdt, node, "read-only", NULL) != NULL;
+  disk = disk_open(disk_path, read_only);
   if (disk == NULL) {
+    if (f != NULL) {
+      goto host_file;
+    }
     return ERR_POSIX;
   }
 
-  err = disk_find_part(disk, atoi(p), &part);
+  err = disk_find_part(disk, p != NULL ? atoi(p) : 0, &part);
   if (err != ERR_NONE) {
     goto done;
   }
 
+  if (f != NULL) {
+    fs_t *fs;
+    fs_file_t *file;
+
+    fs = fs_mount(disk, &part);
+    if (fs == NULL) {
+      goto host_file;
+    }
+
+    err = fs_open(fs, f, &file);
+    if (err != ERR_NONE) {
+      VERBOSE("'%s' not found on %s, trying host", f, fs_name(fs));
+      goto host_file;
+    }
+
+    err = rom_ihandle_from_fs(file, path, ihandle);
+    if (err != ERR_NONE) {
+      fs_close(file);
+    }
+    goto done;
+  }
+
   err = rom_ihandle_from_disk(disk, &part,
                               path, ihandle);
+  goto done;
+
+ host_file:
+  /*
+   * Not a disk or no usable FS on it, fall back to
+   * reading the file from outside.
+   */
+  err = rom_ihandle_from_file(f, path, ihandle);
  done:
   if (err != ERR_NONE) {
     if (disk != NULL) {
@@ -1502,6 +1926,7 @@ rom_read(gea_t cia,
   cell_t data_ea;
   cell_t len_in;
   cell_t len_out;
+  const uint8_t *src;
   ihandle_methods_t *methods;
 
   err = guest_from_x(&ihandle, CIA_ARG(0));
@@ -1527,9 +1952,21 @@ rom_read(gea_t cia,
     xfer = min(xfer, sizeof(xfer_buf));
 
     BUG_ON(PFN(data_ea) != PFN(data_ea + xfer - 1), "bad len");
-    xferred = methods->read(methods, xfer_buf, xfer);
+    src = NULL;
+    if (methods->read_map != NULL) {
+      xferred = xfer;
+      src = methods->read_map(methods, &xferred);
+    }
 
-    err = guest_to(data_ea, xfer_buf, xferred, 1);
+    if (src != NULL) {
+      /*
+       * Backing store is mapped, skip the bounce through xfer_buf.
+       */
+      err = guest_to(data_ea, src, xferred, 1);
+    } else {
+      xferred = methods->read(methods, xfer_buf, xfer);
+      err = guest_to(data_ea, xfer_buf, xferred, 1);
+    }
     ON_ERROR("data", err, partial);
 
     len_in -= xferred;
@@ -1656,6 +2093,45 @@ cif_handler_t handlers[] = {
   { rom_ptopath, "package-to-path" }
 };
 
+/*
+ * Service name of the last CIF call, for trace filters. Only
+ * valid while guest->exits hasn't moved past service_exit.
+ * The id is 1 + the index into handlers, or 0 if unsupported.
+ */
+static char last_service[32];
+static unsigned last_service_id;
+static uint64_t last_service_exit;
+
+const char *
+rom_last_service(void)
+{
+  if (last_service_exit != guest->exits) {
+    return NULL;
+  }
+
+  return last_service;
+}
+
+unsigned
+rom_last_service_id(void)
+{
+  if (last_service_exit != guest->exits) {
+    return 0;
+  }
+
+  return last_service_id;
+}
+
+const char *
+rom_service_name(unsigned id)
+{
+  if (id == 0 || id > ARRAY_LEN(handlers)) {
+    return NULL;
+  }
+
+  return handlers[id - 1].name;
+}
+
 err_t
 rom_call(void)
 {
@@ -1689,10 +2165,17 @@ rom_call(void)
   ON_ERROR("out count", err, done);
 
   service[guest_from_ex(&service, service_ea, sizeof(service) - 1, 1, true)] = '\0';
+  strcpy(last_service, service);
+  last_service_id = 0;
+  last_service_exit = guest->exits;
 
   for (i = 0; i < ARRAY_LEN(handlers); i++) {
     if (!strcmp(service, handlers[i].name)) {
+      uint64_t start = hist_time_ns();
+
+      last_service_id = i + 1;
       err = handlers[i].handler(cia, in_count, out_count);
+      stats_cif(service, start);
       break;
     }
   }
@@ -1740,6 +2223,14 @@ rom_fault(gea_t gea,
   return ERR_NONE;
 }
 
+void
+rom_arena_usage(length_t *used,
+                length_t *size)
+{
+  *used = claim_arena_ptr - claim_arena_start;
+  *size = claim_arena_end - claim_arena_start;
+}
+
 void
 rom_mon_dump(void)
 {
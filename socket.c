@@ -1,136 +1,715 @@
+/*
+ * Accepting connections, reading from them and writing queued
+ * output to them happens on the I/O thread. Input from the first
+ * client (the writer) goes into a lock-free ring, everyone gets
+ * the output. The VM thread only ever sees the result: connects,
+ * disconnects and the on_connect/on_disconnect callbacks are all
+ * processed lazily in socket_handle_connect(), so nothing here
+ * needs a syscall unless there is something to do.
+ */
+
 #define LOG_PFX SOCKET
 #include "socket.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+
+#define SOCKET_IN_SIZE  4096
+#define SOCKET_OUT_SIZE (64 * 1024)
 
 bool
 socket_connected(socket_t *s)
 {
-  return s->fd != -1;
+  return s->connected != 0;
 }
 
-void
-socket_disconnect(socket_t *s)
+static void
+socket_signal(socket_t *s)
 {
-  if (s->fd != -1) {
-    if (s->on_disconnect != NULL) {
-      s->on_disconnect(s);
+  pthread_mutex_lock(&s->lock);
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void
+socket_event(socket_t *s)
+{
+  ring_mb();
+  s->events = true;
+  socket_signal(s);
+}
+
+/*
+ * I/O thread.
+ */
+static void
+socket_client_hangup(socket_client_t *c)
+{
+  unsigned i;
+  socket_t *s = c->s;
+
+  io_unwatch(&c->in_watch);
+  io_unwatch(&c->out_watch);
+  c->hangup = true;
+
+  /*
+   * Whoever has been connected longest
+   * takes over the input.
+   */
+  if (s->writer == c) {
+    s->writer = NULL;
+    for (i = 0; i < s->max_clients; i++) {
+      socket_client_t *n = &s->clients[i];
+
+      if (n->in_use && !n->hangup &&
+          (s->writer == NULL || n->seq < s->writer->seq)) {
+        s->writer = n;
+      }
     }
-    close(s->fd);
-    s->fd = -1;
   }
+
+  socket_event(s);
 }
 
-err_t
-socket_handle_connect(socket_t *s)
+/*
+ * I/O thread.
+ */
+static void
+socket_on_accept(io_watch_t *w)
 {
+  int fd;
+  unsigned i;
   socklen_t len;
   int sockoptval = 1;
-  struct sockaddr_in cli;
+  struct sockaddr_storage cli;
+  socket_client_t *c = NULL;
+  socket_t *s = w->arg;
 
-  if (s->fd == -1) {
-    len = sizeof(cli);
-    s->fd = accept(s->sockfd, (struct sockaddr *) &cli, &len);
+  len = sizeof(cli);
+  fd = accept(w->fd, (struct sockaddr *) &cli, &len);
+  if (fd == -1) {
+    return;
+  }
 
-    if (s->fd != -1) {
-      setsockopt(s->fd, SOL_SOCKET, SO_NOSIGPIPE,
-                 &sockoptval, sizeof(int));
+  for (i = 0; i < s->max_clients; i++) {
+    if (!s->clients[i].in_use) {
+      c = &s->clients[i];
+      break;
+    }
+  }
 
-      if (s->on_connect != NULL) {
-        s->on_connect(s);
-      }
-      return ERR_NONE;
+  if (c == NULL) {
+    WARN("too many clients, refusing connection");
+    close(fd);
+    return;
+  }
+
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE,
+             &sockoptval, sizeof(int));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  c->fd = fd;
+  c->out.head = c->out.tail = 0;
+  c->out_armed = false;
+  c->dropped = 0;
+  c->hangup = false;
+  c->seq = s->next_seq++;
+  telnet_init(&c->tn);
+  c->in_watch.fd = fd;
+  c->out_watch.fd = fd;
+  if (io_watch(&c->in_watch) != ERR_NONE) {
+    close(fd);
+    return;
+  }
+
+  /*
+   * Fires right away, finds nothing queued and
+   * disables itself until there's output.
+   */
+  if (io_watch(&c->out_watch) != ERR_NONE) {
+    io_unwatch(&c->in_watch);
+    close(fd);
+    return;
+  }
+
+  c->in_use = true;
+  if (s->writer == NULL) {
+    s->writer = c;
+  }
+
+  c->pending = true;
+  socket_event(s);
+}
+
+static void
+socket_client_kick(socket_client_t *c)
+{
+  ring_mb();
+  if (!c->out_armed && !c->hangup) {
+    c->out_armed = true;
+    io_enable(&c->out_watch, true);
+  }
+}
+
+/*
+ * I/O thread, for telnet option refusals. These are tiny
+ * and can't wait for the VM thread, so if there's no room
+ * the option just goes unanswered.
+ */
+static void
+socket_client_reply(void *arg,
+                    const uint8_t *buf,
+                    length_t len)
+{
+  socket_client_t *c = arg;
+  socket_t *s = c->s;
+
+  pthread_mutex_lock(&s->lock);
+  if (!c->hangup && ring_space(&c->out) >= len) {
+    ring_put(&c->out, buf, len);
+    socket_client_kick(c);
+  } else {
+    VERBOSE("no room to reply to client %u",
+            (unsigned) (c - s->clients));
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * I/O thread.
+ */
+static void
+socket_on_input(io_watch_t *w)
+{
+  int ret;
+  length_t len;
+  uint8_t buf[256];
+  socket_client_t *c = w->arg;
+  socket_t *s = c->s;
+
+  if (s->writer == c) {
+    len = min(sizeof(buf), ring_space(&s->in));
+    if (len == 0) {
+      /*
+       * Stop reading until the VM thread catches up.
+       */
+      io_enable(w, false);
+      s->throttled = c;
+      socket_signal(s);
+      return;
     }
   } else {
-    return ERR_NONE;
+    /*
+     * Read-only client, input is thrown away.
+     */
+    len = sizeof(buf);
+  }
+
+  ret = read(w->fd, buf, len);
+  if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+
+  if (ret <= 0) {
+    socket_client_hangup(c);
+    return;
+  }
+
+  if (s->telnet) {
+    ret = telnet_in(&c->tn, buf, ret, socket_client_reply, c);
   }
 
-  return ERR_NOT_READY;
+  if (s->writer == c && ret != 0) {
+    ring_put(&s->in, buf, ret);
+    socket_signal(s);
+  }
 }
 
+/*
+ * I/O thread.
+ */
+static void
+socket_on_output(io_watch_t *w)
+{
+  int ret;
+  length_t len;
+  const uint8_t *p;
+  socket_client_t *c = w->arg;
+  socket_t *s = c->s;
+
+  while ((p = ring_peek(&c->out, &len)) != NULL) {
+    ret = write(w->fd, p, len);
+    if (ret < 0) {
+      if (errno == EAGAIN || errno == EINTR) {
+        return;
+      }
+
+      socket_client_hangup(c);
+      return;
+    }
+
+    ring_consume(&c->out, ret);
+    if (s->lossless) {
+      socket_signal(s);
+    }
+
+    if (ret != len) {
+      return;
+    }
+  }
+
+  /*
+   * Drained. Don't miss output queued while disarming.
+   */
+  io_enable(w, false);
+  c->out_armed = false;
+  ring_mb();
+  if (ring_count(&c->out) != 0) {
+    c->out_armed = true;
+    io_enable(w, true);
+  }
+}
+
+/*
+ * Only once the I/O thread is gone, i.e. during shutdown.
+ */
+static void
+socket_client_write_sync(socket_client_t *c,
+                         const uint8_t *buf,
+                         length_t len)
+{
+  int ret;
+
+  fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) & ~O_NONBLOCK);
+  while (len != 0) {
+    ret = write(c->fd, buf, len);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      c->hangup = true;
+      return;
+    }
+
+    buf += ret;
+    len -= ret;
+  }
+}
+
+static void
+socket_client_drain_sync(socket_client_t *c)
+{
+  length_t len;
+  const uint8_t *p;
+
+  while (!c->hangup &&
+         (p = ring_peek(&c->out, &len)) != NULL) {
+    socket_client_write_sync(c, p, len);
+    ring_consume(&c->out, len);
+  }
+}
+
+/*
+ * The output ring has two producers, this and the telnet
+ * replies sent by the I/O thread, so puts happen under the
+ * lock. A put of two bytes (an escaped 0xff) is never split,
+ * so a reply can't land between the two halves.
+ */
+static void
+socket_client_put_raw(socket_t *s,
+                      socket_client_t *c,
+                      const uint8_t *buf,
+                      length_t len)
+{
+  length_t done;
+
+  if (!c->connected || c->hangup) {
+    return;
+  }
+
+  if (!io_running()) {
+    socket_client_drain_sync(c);
+    if (!c->hangup) {
+      socket_client_write_sync(c, buf, len);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  while (len != 0) {
+    if (ring_space(&c->out) >= min(len, 2U)) {
+      done = ring_put(&c->out, buf, len);
+      buf += done;
+      len -= done;
+      socket_client_kick(c);
+
+      if (len == 0) {
+        break;
+      }
+    }
+
+    if (!s->lossless) {
+      if (c->dropped == 0) {
+        WARN("client %u is too slow, dropping output",
+             (unsigned) (c - s->clients));
+      }
+      c->dropped += len;
+      break;
+    }
+
+    while (ring_space(&c->out) < min(len, 2U) && !c->hangup) {
+      pthread_cond_wait(&s->cond, &s->lock);
+    }
+
+    if (c->hangup) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void
+socket_client_put(socket_t *s,
+                  socket_client_t *c,
+                  const uint8_t *buf,
+                  length_t len)
+{
+  const uint8_t *iac;
+  static const uint8_t iac_iac[2] = { TELNET_IAC, TELNET_IAC };
+
+  if (!s->telnet) {
+    socket_client_put_raw(s, c, buf, len);
+    return;
+  }
+
+  /*
+   * 0xff is IAC, and has to be doubled. Rare
+   * enough to not bother copying the buffer.
+   */
+  while ((iac = memchr(buf, TELNET_IAC, len)) != NULL) {
+    length_t run = iac - buf;
+
+    socket_client_put_raw(s, c, buf, run);
+    socket_client_put_raw(s, c, iac_iac, sizeof(iac_iac));
+    buf += run + 1;
+    len -= run + 1;
+  }
+
+  socket_client_put_raw(s, c, buf, len);
+}
+
+static void
+socket_client_close(socket_t *s,
+                    socket_client_t *c)
+{
+  if (c->connected) {
+    if (s->on_disconnect != NULL) {
+      s->on_disconnect(s, c);
+    }
+    c->connected = false;
+    s->connected--;
+  }
+
+  if (c->dropped != 0) {
+    LOG("client %u lost %llu bytes of output",
+        (unsigned) (c - s->clients), c->dropped);
+  }
+
+  close(c->fd);
+  c->fd = -1;
+  ring_mb();
+  c->in_use = false;
+}
+
+/*
+ * Picks up whatever the I/O thread did since the last call.
+ */
 err_t
-socket_init(socket_t *s)
+socket_handle_connect(socket_t *s)
 {
+  unsigned i;
+  socket_client_t *c;
+
+  if (s->events) {
+    s->events = false;
+    ring_mb();
+
+    for (i = 0; i < s->max_clients; i++) {
+      c = &s->clients[i];
+      if (!c->in_use) {
+        continue;
+      }
+
+      if (c->pending) {
+        c->pending = false;
+        c->connected = true;
+        s->connected++;
+        if (s->telnet) {
+          socket_client_put_raw(s, c, (const uint8_t *) TELNET_HELLO,
+                                sizeof(TELNET_HELLO) - 1);
+        }
+        if (s->on_connect != NULL) {
+          s->on_connect(s, c);
+        }
+      }
+
+      if (c->hangup) {
+        if (s->throttled == c) {
+          s->throttled = NULL;
+        }
+        socket_client_close(s, c);
+      }
+    }
+  }
+
+  c = s->throttled;
+  if (c != NULL &&
+      ring_space(&s->in) >= s->in.size / 2) {
+    s->throttled = NULL;
+    io_enable(&c->in_watch, true);
+  }
+
+  return s->connected != 0 ? ERR_NONE : ERR_NOT_READY;
+}
+
+/*
+ * Blocks until a client connects.
+ */
+void
+socket_wait_connect(socket_t *s)
+{
+  while (socket_handle_connect(s) != ERR_NONE) {
+    pthread_mutex_lock(&s->lock);
+    while (!s->events) {
+      pthread_cond_wait(&s->cond, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+/*
+ * Blocks until there's input, or something for
+ * socket_handle_connect() to do.
+ */
+void
+socket_wait_input(socket_t *s)
+{
+  pthread_mutex_lock(&s->lock);
+  while (ring_count(&s->in) == 0 && !s->events &&
+         s->throttled == NULL) {
+    pthread_cond_wait(&s->cond, &s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+static int
+socket_listen_fd(socket_t *s)
+{
+  int fd;
   int sockflags;
   int sockoptval = 1;
   struct sockaddr_in servaddr;
+  struct sockaddr_un unaddr;
+
+  if (s->path != NULL) {
+    fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+      POSIX_ERROR(errno, "socket");
+      return -1;
+    }
+
+    memset(&unaddr, 0, sizeof(unaddr));
+    unaddr.sun_family = AF_UNIX;
+    strlcpy(unaddr.sun_path, s->path, sizeof(unaddr.sun_path));
+    unlink(s->path);
+
+    if (bind(fd, (struct sockaddr *) &unaddr, sizeof(unaddr)) != 0) {
+      POSIX_ERROR(errno, "bind '%s'", s->path);
+      close(fd);
+      return -1;
+    }
+  } else {
+    fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+      POSIX_ERROR(errno, "socket");
+      return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &sockoptval, sizeof(int));
+
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = INADDR_ANY;
+    servaddr.sin_port = htons(s->port);
+
+    if (bind(fd, (struct sockaddr *) &servaddr, sizeof(servaddr)) != 0) {
+      POSIX_ERROR(errno, "bind");
+      close(fd);
+      return -1;
+    }
+  }
+
+  sockflags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, sockflags | O_NONBLOCK);
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &sockoptval, sizeof(int));
 
-  s->fd = -1;
-  s->sockfd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (listen(fd, s->max_clients) != 0) {
+    POSIX_ERROR(errno, "listen");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+err_t
+socket_init(socket_t *s)
+{
+  err_t err;
+  unsigned i;
+  length_t in_size = SOCKET_IN_SIZE;
+
+  s->max_clients = min(max(s->max_clients, 1U), SOCKET_MAX_CLIENTS);
+  while (in_size < min(s->in_size, SOCKET_IN_MAX)) {
+    in_size <<= 1;
+  }
+  s->in_size = in_size;
+  s->connected = 0;
+  s->writer = NULL;
+  s->throttled = NULL;
+  s->events = false;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+
+  err = ring_init(&s->in, s->in_size);
+  if (err != ERR_NONE) {
+    return err;
+  }
+
+  for (i = 0; i < s->max_clients; i++) {
+    socket_client_t *c = &s->clients[i];
+
+    memset(c, 0, sizeof(*c));
+    c->s = s;
+    c->fd = -1;
+    c->in_watch.cb = socket_on_input;
+    c->in_watch.arg = c;
+    c->out_watch.write = true;
+    c->out_watch.cb = socket_on_output;
+    c->out_watch.arg = c;
+
+    err = ring_init(&c->out, SOCKET_OUT_SIZE);
+    if (err != ERR_NONE) {
+      return err;
+    }
+  }
+
+  s->sockfd = socket_listen_fd(s);
   if (s->sockfd < 0) {
-    POSIX_ERROR(errno, "socket");
     return ERR_POSIX;
   }
 
-  sockflags = fcntl(s->sockfd, F_GETFL);
-  fcntl(s->sockfd, F_SETFL, sockflags | O_NONBLOCK);
+  s->listen.fd = s->sockfd;
+  s->listen.write = false;
+  s->listen.cb = socket_on_accept;
+  s->listen.arg = s;
+  return io_watch(&s->listen);
+}
+
+/*
+ * Shutdown, after io_bye(): flushes what's still queued,
+ * says goodbye and closes everything.
+ */
+void
+socket_bye(socket_t *s)
+{
+  unsigned i;
 
-  setsockopt(s->sockfd, SOL_SOCKET, SO_REUSEADDR, &sockoptval, sizeof(int));
-  setsockopt(s->sockfd, SOL_SOCKET, SO_NOSIGPIPE, &sockoptval, sizeof(int));
+  for (i = 0; i < s->max_clients; i++) {
+    socket_client_t *c = &s->clients[i];
 
-  memset(&servaddr, 0, sizeof(servaddr));
-  servaddr.sin_family = AF_INET;
-  servaddr.sin_addr.s_addr = INADDR_ANY;
-  servaddr.sin_port = htons(s->port);
+    if (!c->in_use) {
+      continue;
+    }
 
-  if (bind(s->sockfd, (struct sockaddr *) &servaddr, sizeof(servaddr)) != 0) {
-    POSIX_ERROR(errno, "bind");
-    return ERR_POSIX;
+    if (c->pending) {
+      c->pending = false;
+    } else {
+      socket_client_drain_sync(c);
+    }
+    socket_client_close(s, c);
+    ring_free(&c->out);
   }
 
-  if (listen(s->sockfd, 1) != 0) {
-    POSIX_ERROR(errno, "listen");
-    return ERR_POSIX;
+  close(s->sockfd);
+  if (s->path != NULL) {
+    unlink(s->path);
+  }
+  ring_free(&s->in);
+}
+
+void
+socket_client_outv(socket_t *s,
+                   socket_client_t *c,
+                   struct iovec *iov,
+                   int iovcnt)
+{
+  int i;
+
+  for (i = 0; i < iovcnt; i++) {
+    socket_client_put(s, c, iov[i].iov_base, iov[i].iov_len);
   }
+}
 
-  return ERR_NONE;
+void
+socket_client_out(socket_t *s,
+                  socket_client_t *c,
+                  const char *buf,
+                  length_t len)
+{
+  socket_client_put(s, c, (const uint8_t *) buf, len);
 }
 
 void
-socket_out(socket_t *s,
-           const char *buf,
-           length_t len)
+socket_outv(socket_t *s,
+            struct iovec *iov,
+            int iovcnt)
 {
-  int written;
+  unsigned i;
 
   if (socket_handle_connect(s) != ERR_NONE) {
     return;
   }
 
-  while (len != 0) {
-    written = write(s->fd, buf, len);
-    if (written == -1) {
-      POSIX_ERROR(errno, "term write");
+  for (i = 0; i < s->max_clients; i++) {
+    if (s->clients[i].connected) {
+      socket_client_outv(s, &s->clients[i], iov, iovcnt);
     }
-
-    len -= written;
-    buf += written;
   }
 }
 
+void
+socket_out(socket_t *s,
+           const char *buf,
+           length_t len)
+{
+  struct iovec iov;
+
+  iov.iov_base = (char *) buf;
+  iov.iov_len = len;
+  socket_outv(s, &iov, 1);
+}
+
 length_t
 socket_in(socket_t *s,
           char *buf,
           length_t expected)
 {
-  int ret;
-
-  if (socket_handle_connect(s) != ERR_NONE) {
-    return 0;
-  }
-
-  ret = read(s->fd, buf, expected);
-  if (ret == 0) {
-    socket_disconnect(s);
-  } else if (ret == -1) {
-    if (errno != EAGAIN) {
-      POSIX_ERROR(errno, "read");
-    }
-    return 0;
-  }
-  return ret;
+  socket_handle_connect(s);
+  return ring_get(&s->in, (uint8_t *) buf, expected);
 }
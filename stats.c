@@ -0,0 +1,386 @@
+#define LOG_PFX STATS
+#include "stats.h"
+#include "guest.h"
+#include "disk.h"
+#include "term.h"
+#include "rom.h"
+#include "mon.h"
+
+#include <stdarg.h>
+
+/*
+ * Return codes past the last slot are counted together.
+ */
+#define STATS_EXITS 32
+#define STATS_CIFS  32
+#define STATS_EMULS 16
+#define NAME_LEN    32
+#define COUNTERS    128
+
+typedef struct {
+  char name[NAME_LEN];
+  hist_t lat;
+} stats_named_t;
+
+static hist_t exits[STATS_EXITS + 1];
+static stats_named_t cifs[STATS_CIFS];
+static stats_named_t emuls[STATS_EMULS];
+static uint64_t start_ns;
+
+typedef enum {
+  GROUP_EXITS,
+  GROUP_CIF,
+  GROUP_EMUL,
+  GROUP_DISK,
+  GROUP_CONSOLE,
+  GROUP_ARENA,
+} stats_group_t;
+
+static const char *group_names[] = {
+  "exits", "cif", "emul", "disk", "console", "arena",
+};
+
+/*
+ * Counters as of the last two JSON snapshots, for deltas.
+ */
+typedef struct {
+  stats_group_t group;
+  char name[NAME_LEN];
+  uint64_t value;
+} stats_counter_t;
+
+static struct {
+  uint64_t seq;
+  uint64_t time_ns;
+  count_t count;
+  stats_counter_t counters[COUNTERS];
+} snaps[2];
+static unsigned snap_cur;
+
+void
+stats_init(void)
+{
+  start_ns = hist_time_ns();
+  snaps[0].time_ns = start_ns;
+  snaps[1].time_ns = start_ns;
+}
+
+void
+stats_exit(vmm_return_code_t code,
+           uint64_t start_ns)
+{
+  hist_record(exits + min(code, STATS_EXITS),
+              hist_time_ns() - start_ns);
+}
+
+/*
+ * Names come and stay in first-seen order. Once the table
+ * is full, further names aren't counted.
+ */
+static void
+stats_named(stats_named_t *table,
+            count_t count,
+            const char *name,
+            uint64_t start_ns)
+{
+  unsigned i;
+
+  for (i = 0; i < count; i++) {
+    if (table[i].name[0] == '\0') {
+      strlcpy(table[i].name, name, sizeof(table[i].name));
+      break;
+    }
+
+    if (!strcmp(table[i].name, name)) {
+      break;
+    }
+  }
+
+  if (i != count) {
+    hist_record(&table[i].lat, hist_time_ns() - start_ns);
+  }
+}
+
+void
+stats_cif(const char *service,
+          uint64_t start_ns)
+{
+  stats_named(cifs, ARRAY_LEN(cifs), service, start_ns);
+}
+
+void
+stats_emul(const char *op,
+           uint64_t start_ns)
+{
+  stats_named(emuls, ARRAY_LEN(emuls), op, start_ns);
+}
+
+void
+stats_reset(void)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_LEN(exits); i++) {
+    hist_init(exits + i);
+  }
+
+  for (i = 0; i < ARRAY_LEN(cifs); i++) {
+    hist_init(&cifs[i].lat);
+  }
+
+  for (i = 0; i < ARRAY_LEN(emuls); i++) {
+    hist_init(&emuls[i].lat);
+  }
+}
+
+static void
+stats_out(bool log,
+          const char *fmt,
+          ...)
+{
+  char buf[512];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  if (log) {
+    LOG("%s", buf);
+  } else {
+    mon_printf("%s\n", buf);
+  }
+}
+
+static void
+stats_dump_named(bool log,
+                 const char *what,
+                 stats_named_t *table,
+                 count_t count)
+{
+  unsigned i;
+  char buf[256];
+
+  for (i = 0; i < count && table[i].name[0] != '\0'; i++) {
+    if (table[i].lat.count != 0) {
+      hist_format(&table[i].lat, "ns", buf, sizeof(buf));
+      stats_out(log, "%s %-27s %s", what, table[i].name, buf);
+    }
+  }
+}
+
+/*
+ * Codes vmm.h has no name for are told apart by number.
+ */
+static const char *
+stats_exit_name(unsigned index,
+                char *buf,
+                length_t size)
+{
+  const char *name;
+
+  if (index == STATS_EXITS) {
+    return "other";
+  }
+
+  name = vmm_return_code_to_string(index);
+  if (!strcmp(name, "unknown")) {
+    snprintf(buf, size, "code_%u", index);
+    return buf;
+  }
+
+  return name;
+}
+
+static void
+stats_dump(bool log)
+{
+  unsigned i;
+  char buf[256];
+  char name[NAME_LEN];
+
+  for (i = 0; i < ARRAY_LEN(exits); i++) {
+    if (exits[i].count != 0) {
+      hist_format(exits + i, "ns", buf, sizeof(buf));
+      stats_out(log, "exit %-27s %s",
+                stats_exit_name(i, name, sizeof(name)), buf);
+    }
+  }
+
+  stats_dump_named(log, "cif ", cifs, ARRAY_LEN(cifs));
+  stats_dump_named(log, "emul", emuls, ARRAY_LEN(emuls));
+}
+
+static void
+stats_add(stats_group_t group,
+          const char *name,
+          uint64_t value)
+{
+  char *p;
+  stats_counter_t *c;
+
+  if (snaps[snap_cur].count == COUNTERS) {
+    return;
+  }
+
+  c = snaps[snap_cur].counters + snaps[snap_cur].count++;
+  c->group = group;
+  c->value = value;
+  strlcpy(c->name, name, sizeof(c->name));
+  for (p = c->name; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\' || *p < ' ') {
+      *p = '_';
+    }
+  }
+}
+
+static void
+stats_add_named(stats_group_t group,
+                stats_named_t *table,
+                count_t count)
+{
+  unsigned i;
+
+  for (i = 0; i < count && table[i].name[0] != '\0'; i++) {
+    stats_add(group, table[i].name, table[i].lat.count);
+  }
+}
+
+/*
+ * Counters only grow, so they're usually at the same index
+ * in the last snapshot. A counter that went backwards
+ * (stats reset) counts from zero.
+ */
+static uint64_t
+stats_delta(unsigned index)
+{
+  unsigned i;
+  stats_counter_t *c = snaps[snap_cur].counters + index;
+  stats_counter_t *prev = snaps[snap_cur ^ 1].counters;
+  count_t prev_count = snaps[snap_cur ^ 1].count;
+
+  for (i = 0; i < prev_count; i++) {
+    stats_counter_t *p = prev + (index + i) % prev_count;
+
+    if (p->group == c->group && !strcmp(p->name, c->name)) {
+      return c->value >= p->value ? c->value - p->value : c->value;
+    }
+  }
+
+  return c->value;
+}
+
+/*
+ * The monitor sends at most PICOL_MAX_STR at a time.
+ */
+static char json_buf[1024];
+static length_t json_len;
+
+static void
+stats_json_out(const char *fmt,
+               ...)
+{
+  int n;
+  va_list ap;
+
+  va_start(ap, fmt);
+  n = vsnprintf(json_buf + json_len, sizeof(json_buf) - json_len, fmt, ap);
+  va_end(ap);
+
+  if (json_len + n >= sizeof(json_buf)) {
+    json_buf[json_len] = '\0';
+    mon_printf("%s", json_buf);
+    json_len = 0;
+
+    va_start(ap, fmt);
+    n = vsnprintf(json_buf, sizeof(json_buf), fmt, ap);
+    va_end(ap);
+  }
+
+  json_len += n;
+}
+
+/*
+ * One line of JSON with every counter's total and its change
+ * since the previous snapshot, which the poller can divide
+ * by interval_ns for a rate. Snapshots are shared, so there
+ * should only be one poller.
+ */
+void
+stats_json(void)
+{
+  unsigned i;
+  uint64_t now;
+  uint64_t in;
+  uint64_t out;
+  length_t used;
+  length_t size;
+  int group = -1;
+  char name[NAME_LEN];
+  disk_io_stats_t disk;
+
+  snap_cur ^= 1;
+  snaps[snap_cur].count = 0;
+  snaps[snap_cur].seq = snaps[snap_cur ^ 1].seq + 1;
+  snaps[snap_cur].time_ns = now = hist_time_ns();
+
+  stats_add(GROUP_EXITS, "all", guest->exits);
+  for (i = 0; i < ARRAY_LEN(exits); i++) {
+    if (exits[i].count != 0) {
+      stats_add(GROUP_EXITS, stats_exit_name(i, name, sizeof(name)),
+                exits[i].count);
+    }
+  }
+  stats_add_named(GROUP_CIF, cifs, ARRAY_LEN(cifs));
+  stats_add_named(GROUP_EMUL, emuls, ARRAY_LEN(emuls));
+
+  disk_io_totals(&disk);
+  stats_add(GROUP_DISK, "reads", disk.reads);
+  stats_add(GROUP_DISK, "writes", disk.writes);
+  stats_add(GROUP_DISK, "read_bytes", disk.read_bytes);
+  stats_add(GROUP_DISK, "write_bytes", disk.write_bytes);
+  stats_add(GROUP_DISK, "seeks", disk.seeks);
+
+  term_io_counts(&in, &out);
+  stats_add(GROUP_CONSOLE, "in_bytes", in);
+  stats_add(GROUP_CONSOLE, "out_bytes", out);
+
+  rom_arena_usage(&used, &size);
+  stats_add(GROUP_ARENA, "used", used);
+  stats_add(GROUP_ARENA, "size", size);
+
+  stats_json_out("{\"seq\":%llu,\"uptime_ns\":%llu,\"interval_ns\":%llu",
+                 snaps[snap_cur].seq, now - start_ns,
+                 now - snaps[snap_cur ^ 1].time_ns);
+  for (i = 0; i < snaps[snap_cur].count; i++) {
+    stats_counter_t *c = snaps[snap_cur].counters + i;
+
+    if (c->group != group) {
+      stats_json_out("%s,\"%s\":{", group >= 0 ? "}" : "",
+                     group_names[c->group]);
+      group = c->group;
+    } else {
+      stats_json_out(",");
+    }
+
+    stats_json_out("\"%s\":{\"total\":%llu,\"delta\":%llu}",
+                   c->name, c->value, stats_delta(i));
+  }
+  stats_json_out("%s}\n", group >= 0 ? "}" : "");
+
+  json_buf[json_len] = '\0';
+  mon_printf("%s", json_buf);
+  json_len = 0;
+}
+
+void
+stats_mon_dump(void)
+{
+  stats_dump(false);
+}
+
+void
+stats_bye(void)
+{
+  stats_dump(true);
+}
@@ -0,0 +1,142 @@
+/*
+ * Just enough telnet for the console: character mode, server
+ * side echo, window size, and stripping everything else out
+ * of the input. Runs on the I/O thread.
+ *
+ * Requests for options we don't do are refused right away
+ * through the reply callback, which queues them behind the
+ * client's pending output.
+ */
+
+#define LOG_PFX TELNET
+#include "telnet.h"
+
+enum {
+  TN_DATA,
+  TN_IAC,
+  TN_OPT,
+  TN_SB,
+  TN_SB_IAC,
+};
+
+void
+telnet_init(telnet_t *t)
+{
+  memset(t, 0, sizeof(*t));
+  t->state = TN_DATA;
+}
+
+static void
+telnet_opt(telnet_t *t,
+           uint8_t opt,
+           telnet_reply_t reply,
+           void *arg)
+{
+  uint8_t r[3] = { TELNET_IAC, 0, opt };
+
+  switch (t->cmd) {
+  case TELNET_WILL:
+    if (opt != TELNET_OPT_SGA && opt != TELNET_OPT_NAWS) {
+      r[1] = TELNET_DONT;
+      reply(arg, r, sizeof(r));
+    }
+    break;
+  case TELNET_DO:
+    if (opt != TELNET_OPT_SGA && opt != TELNET_OPT_ECHO) {
+      r[1] = TELNET_WONT;
+      reply(arg, r, sizeof(r));
+    }
+    break;
+  default:
+    /*
+     * WONT and DONT for something we asked
+     * for. Not much to be done about it.
+     */
+    break;
+  }
+}
+
+static void
+telnet_sb(telnet_t *t)
+{
+  if (t->sb_len == 5 && t->sb[0] == TELNET_OPT_NAWS) {
+    uint16_t cols = (t->sb[1] << 8) | t->sb[2];
+    uint16_t rows = (t->sb[3] << 8) | t->sb[4];
+
+    if (cols != t->cols || rows != t->rows) {
+      t->cols = cols;
+      t->rows = rows;
+      VERBOSE("window is %ux%u", cols, rows);
+    }
+  }
+}
+
+/*
+ * Strips telnet commands from buf in place, and
+ * returns how much data is left.
+ */
+length_t
+telnet_in(telnet_t *t,
+          uint8_t *buf,
+          length_t len,
+          telnet_reply_t reply,
+          void *arg)
+{
+  length_t i;
+  length_t out = 0;
+
+  for (i = 0; i < len; i++) {
+    uint8_t c = buf[i];
+
+    switch (t->state) {
+    case TN_DATA:
+      if (c == TELNET_IAC) {
+        t->state = TN_IAC;
+      } else {
+        buf[out++] = c;
+      }
+      break;
+    case TN_IAC:
+      t->state = TN_DATA;
+      if (c == TELNET_IAC) {
+        buf[out++] = c;
+      } else if (c >= TELNET_WILL && c <= TELNET_DONT) {
+        t->cmd = c;
+        t->state = TN_OPT;
+      } else if (c == TELNET_SB) {
+        t->sb_len = 0;
+        t->state = TN_SB;
+      } else if (c == TELNET_IP) {
+        /*
+         * ^C, for clients that send it as a command.
+         */
+        buf[out++] = 0x03;
+      }
+      break;
+    case TN_OPT:
+      telnet_opt(t, c, reply, arg);
+      t->state = TN_DATA;
+      break;
+    case TN_SB:
+    case TN_SB_IAC:
+      if (t->state == TN_SB && c == TELNET_IAC) {
+        t->state = TN_SB_IAC;
+        break;
+      }
+
+      if (t->state == TN_SB_IAC && c == TELNET_SE) {
+        telnet_sb(t);
+        t->state = TN_DATA;
+        break;
+      }
+
+      t->state = TN_SB;
+      if (t->sb_len < sizeof(t->sb)) {
+        t->sb[t->sb_len++] = c;
+      }
+      break;
+    }
+  }
+
+  return out;
+}
@@ -1,42 +1,535 @@
 #define LOG_PFX TERM
 #include "term.h"
 #include "socket.h"
+#include "conlog.h"
+#include "guest.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #define PORT 7000
 
+/*
+ * Console output is queued here and pushed out with one
+ * writev() per term_flush(), instead of one write() per byte.
+ */
+#define OUT_RING_SIZE (16 * 1024)
+
+/*
+ * In headless mode the last BACKLOG_SIZE bytes of output are
+ * kept, and replayed to whoever connects.
+ */
+#define BACKLOG_SIZE (64 * 1024)
+
 static socket_t s;
+static char out_ring[OUT_RING_SIZE];
+static length_t out_head;
+static length_t out_count;
+
+static bool headless;
+static int log_fd = -1;
+static char *backlog;
+static length_t backlog_pos;
+static bool backlog_wrapped;
+static char *script;
+static length_t script_len;
+static length_t script_pos;
+static bool in_cr;
+static uint64_t in_bytes;
+static uint64_t out_bytes;
+
+/*
+ * Input record and replay. Every chunk of input handed to
+ * the guest is written out with the exit count it was read
+ * at, and on replay it's held back until the guest has
+ * made as much progress again. Timer pops aren't counted,
+ * as they come with host time.
+ */
+typedef struct replay_event_s {
+  uint64_t exits;
+  length_t off;
+  length_t len;
+} replay_event_t;
+
+static FILE *record;
+static replay_event_t *replay;
+static char *replay_data;
+static count_t replay_count;
+static count_t replay_pos;
+static length_t replay_off;
+
+/*
+ * The firmware console is CP437, sent on as UTF-8. The ARC
+ * 8-bit CSI (0x9b) becomes the 7-bit ESC [ instead.
+ */
+static const struct {
+  uint8_t len;
+  char s[3];
+} out_xlat[256] = {
+  [0x80] = { 2, "\xc3\x87" }, /* U+00C7 */
+  [0x81] = { 2, "\xc3\xbc" }, /* U+00FC */
+  [0x82] = { 2, "\xc3\xa9" }, /* U+00E9 */
+  [0x83] = { 2, "\xc3\xa2" }, /* U+00E2 */
+  [0x84] = { 2, "\xc3\xa4" }, /* U+00E4 */
+  [0x85] = { 2, "\xc3\xa0" }, /* U+00E0 */
+  [0x86] = { 2, "\xc3\xa5" }, /* U+00E5 */
+  [0x87] = { 2, "\xc3\xa7" }, /* U+00E7 */
+  [0x88] = { 2, "\xc3\xaa" }, /* U+00EA */
+  [0x89] = { 2, "\xc3\xab" }, /* U+00EB */
+  [0x8a] = { 2, "\xc3\xa8" }, /* U+00E8 */
+  [0x8b] = { 2, "\xc3\xaf" }, /* U+00EF */
+  [0x8c] = { 2, "\xc3\xae" }, /* U+00EE */
+  [0x8d] = { 2, "\xc3\xac" }, /* U+00EC */
+  [0x8e] = { 2, "\xc3\x84" }, /* U+00C4 */
+  [0x8f] = { 2, "\xc3\x85" }, /* U+00C5 */
+  [0x90] = { 2, "\xc3\x89" }, /* U+00C9 */
+  [0x91] = { 2, "\xc3\xa6" }, /* U+00E6 */
+  [0x92] = { 2, "\xc3\x86" }, /* U+00C6 */
+  [0x93] = { 2, "\xc3\xb4" }, /* U+00F4 */
+  [0x94] = { 2, "\xc3\xb6" }, /* U+00F6 */
+  [0x95] = { 2, "\xc3\xb2" }, /* U+00F2 */
+  [0x96] = { 2, "\xc3\xbb" }, /* U+00FB */
+  [0x97] = { 2, "\xc3\xb9" }, /* U+00F9 */
+  [0x98] = { 2, "\xc3\xbf" }, /* U+00FF */
+  [0x99] = { 2, "\xc3\x96" }, /* U+00D6 */
+  [0x9a] = { 2, "\xc3\x9c" }, /* U+00DC */
+  [0x9b] = { 2, "\33[" },
+  [0x9c] = { 2, "\xc2\xa3" }, /* U+00A3 */
+  [0x9d] = { 2, "\xc2\xa5" }, /* U+00A5 */
+  [0x9e] = { 3, "\xe2\x82\xa7" }, /* U+20A7 */
+  [0x9f] = { 2, "\xc6\x92" }, /* U+0192 */
+  [0xa0] = { 2, "\xc3\xa1" }, /* U+00E1 */
+  [0xa1] = { 2, "\xc3\xad" }, /* U+00ED */
+  [0xa2] = { 2, "\xc3\xb3" }, /* U+00F3 */
+  [0xa3] = { 2, "\xc3\xba" }, /* U+00FA */
+  [0xa4] = { 2, "\xc3\xb1" }, /* U+00F1 */
+  [0xa5] = { 2, "\xc3\x91" }, /* U+00D1 */
+  [0xa6] = { 2, "\xc2\xaa" }, /* U+00AA */
+  [0xa7] = { 2, "\xc2\xba" }, /* U+00BA */
+  [0xa8] = { 2, "\xc2\xbf" }, /* U+00BF */
+  [0xa9] = { 3, "\xe2\x8c\x90" }, /* U+2310 */
+  [0xaa] = { 2, "\xc2\xac" }, /* U+00AC */
+  [0xab] = { 2, "\xc2\xbd" }, /* U+00BD */
+  [0xac] = { 2, "\xc2\xbc" }, /* U+00BC */
+  [0xad] = { 2, "\xc2\xa1" }, /* U+00A1 */
+  [0xae] = { 2, "\xc2\xab" }, /* U+00AB */
+  [0xaf] = { 2, "\xc2\xbb" }, /* U+00BB */
+  [0xb0] = { 3, "\xe2\x96\x91" }, /* U+2591 */
+  [0xb1] = { 3, "\xe2\x96\x92" }, /* U+2592 */
+  [0xb2] = { 3, "\xe2\x96\x93" }, /* U+2593 */
+  [0xb3] = { 3, "\xe2\x94\x82" }, /* U+2502 */
+  [0xb4] = { 3, "\xe2\x94\xa4" }, /* U+2524 */
+  [0xb5] = { 3, "\xe2\x95\xa1" }, /* U+2561 */
+  [0xb6] = { 3, "\xe2\x95\xa2" }, /* U+2562 */
+  [0xb7] = { 3, "\xe2\x95\x96" }, /* U+2556 */
+  [0xb8] = { 3, "\xe2\x95\x95" }, /* U+2555 */
+  [0xb9] = { 3, "\xe2\x95\xa3" }, /* U+2563 */
+  [0xba] = { 3, "\xe2\x95\x91" }, /* U+2551 */
+  [0xbb] = { 3, "\xe2\x95\x97" }, /* U+2557 */
+  [0xbc] = { 3, "\xe2\x95\x9d" }, /* U+255D */
+  [0xbd] = { 3, "\xe2\x95\x9c" }, /* U+255C */
+  [0xbe] = { 3, "\xe2\x95\x9b" }, /* U+255B */
+  [0xbf] = { 3, "\xe2\x94\x90" }, /* U+2510 */
+  [0xc0] = { 3, "\xe2\x94\x94" }, /* U+2514 */
+  [0xc1] = { 3, "\xe2\x94\xb4" }, /* U+2534 */
+  [0xc2] = { 3, "\xe2\x94\xac" }, /* U+252C */
+  [0xc3] = { 3, "\xe2\x94\x9c" }, /* U+251C */
+  [0xc4] = { 3, "\xe2\x94\x80" }, /* U+2500 */
+  [0xc5] = { 3, "\xe2\x94\xbc" }, /* U+253C */
+  [0xc6] = { 3, "\xe2\x95\x9e" }, /* U+255E */
+  [0xc7] = { 3, "\xe2\x95\x9f" }, /* U+255F */
+  [0xc8] = { 3, "\xe2\x95\x9a" }, /* U+255A */
+  [0xc9] = { 3, "\xe2\x95\x94" }, /* U+2554 */
+  [0xca] = { 3, "\xe2\x95\xa9" }, /* U+2569 */
+  [0xcb] = { 3, "\xe2\x95\xa6" }, /* U+2566 */
+  [0xcc] = { 3, "\xe2\x95\xa0" }, /* U+2560 */
+  [0xcd] = { 3, "\xe2\x95\x90" }, /* U+2550 */
+  [0xce] = { 3, "\xe2\x95\xac" }, /* U+256C */
+  [0xcf] = { 3, "\xe2\x95\xa7" }, /* U+2567 */
+  [0xd0] = { 3, "\xe2\x95\xa8" }, /* U+2568 */
+  [0xd1] = { 3, "\xe2\x95\xa4" }, /* U+2564 */
+  [0xd2] = { 3, "\xe2\x95\xa5" }, /* U+2565 */
+  [0xd3] = { 3, "\xe2\x95\x99" }, /* U+2559 */
+  [0xd4] = { 3, "\xe2\x95\x98" }, /* U+2558 */
+  [0xd5] = { 3, "\xe2\x95\x92" }, /* U+2552 */
+  [0xd6] = { 3, "\xe2\x95\x93" }, /* U+2553 */
+  [0xd7] = { 3, "\xe2\x95\xab" }, /* U+256B */
+  [0xd8] = { 3, "\xe2\x95\xaa" }, /* U+256A */
+  [0xd9] = { 3, "\xe2\x94\x98" }, /* U+2518 */
+  [0xda] = { 3, "\xe2\x94\x8c" }, /* U+250C */
+  [0xdb] = { 3, "\xe2\x96\x88" }, /* U+2588 */
+  [0xdc] = { 3, "\xe2\x96\x84" }, /* U+2584 */
+  [0xdd] = { 3, "\xe2\x96\x8c" }, /* U+258C */
+  [0xde] = { 3, "\xe2\x96\x90" }, /* U+2590 */
+  [0xdf] = { 3, "\xe2\x96\x80" }, /* U+2580 */
+  [0xe0] = { 2, "\xce\xb1" }, /* U+03B1 */
+  [0xe1] = { 2, "\xc3\x9f" }, /* U+00DF */
+  [0xe2] = { 2, "\xce\x93" }, /* U+0393 */
+  [0xe3] = { 2, "\xcf\x80" }, /* U+03C0 */
+  [0xe4] = { 2, "\xce\xa3" }, /* U+03A3 */
+  [0xe5] = { 2, "\xcf\x83" }, /* U+03C3 */
+  [0xe6] = { 2, "\xc2\xb5" }, /* U+00B5 */
+  [0xe7] = { 2, "\xcf\x84" }, /* U+03C4 */
+  [0xe8] = { 2, "\xce\xa6" }, /* U+03A6 */
+  [0xe9] = { 2, "\xce\x98" }, /* U+0398 */
+  [0xea] = { 2, "\xce\xa9" }, /* U+03A9 */
+  [0xeb] = { 2, "\xce\xb4" }, /* U+03B4 */
+  [0xec] = { 3, "\xe2\x88\x9e" }, /* U+221E */
+  [0xed] = { 2, "\xcf\x86" }, /* U+03C6 */
+  [0xee] = { 2, "\xce\xb5" }, /* U+03B5 */
+  [0xef] = { 3, "\xe2\x88\xa9" }, /* U+2229 */
+  [0xf0] = { 3, "\xe2\x89\xa1" }, /* U+2261 */
+  [0xf1] = { 2, "\xc2\xb1" }, /* U+00B1 */
+  [0xf2] = { 3, "\xe2\x89\xa5" }, /* U+2265 */
+  [0xf3] = { 3, "\xe2\x89\xa4" }, /* U+2264 */
+  [0xf4] = { 3, "\xe2\x8c\xa0" }, /* U+2320 */
+  [0xf5] = { 3, "\xe2\x8c\xa1" }, /* U+2321 */
+  [0xf6] = { 2, "\xc3\xb7" }, /* U+00F7 */
+  [0xf7] = { 3, "\xe2\x89\x88" }, /* U+2248 */
+  [0xf8] = { 2, "\xc2\xb0" }, /* U+00B0 */
+  [0xf9] = { 3, "\xe2\x88\x99" }, /* U+2219 */
+  [0xfa] = { 2, "\xc2\xb7" }, /* U+00B7 */
+  [0xfb] = { 3, "\xe2\x88\x9a" }, /* U+221A */
+  [0xfc] = { 3, "\xe2\x81\xbf" }, /* U+207F */
+  [0xfd] = { 2, "\xc2\xb2" }, /* U+00B2 */
+  [0xfe] = { 3, "\xe2\x96\xa0" }, /* U+25A0 */
+  [0xff] = { 2, "\xc2\xa0" }, /* U+00A0 */
+};
 
 static void
-term_on_connect(socket_t *s)
+term_backlog_add(const char *buf,
+                 length_t len)
 {
+  length_t chunk;
+
+  if (len > BACKLOG_SIZE) {
+    buf += len - BACKLOG_SIZE;
+    len = BACKLOG_SIZE;
+  }
+
+  while (len != 0) {
+    chunk = min(len, BACKLOG_SIZE - backlog_pos);
+    memcpy(backlog + backlog_pos, buf, chunk);
+    backlog_pos += chunk;
+    if (backlog_pos == BACKLOG_SIZE) {
+      backlog_pos = 0;
+      backlog_wrapped = true;
+    }
+    buf += chunk;
+    len -= chunk;
+  }
+}
+
+static void
+term_on_connect(socket_t *s,
+                socket_client_t *c)
+{
+  int iovcnt = 0;
+  struct iovec iov[2];
   const char *banner =
     "\nThis is the PVP console\r\n"
     "-----------------------\r\n\n";
-  socket_out(s, banner, strlen(banner));
+  socket_client_out(s, c, banner, strlen(banner));
+
+  if (backlog == NULL) {
+    return;
+  }
+
+  /*
+   * Catch the client up on what it missed.
+   */
+  if (backlog_wrapped) {
+    iov[iovcnt].iov_base = backlog + backlog_pos;
+    iov[iovcnt].iov_len = BACKLOG_SIZE - backlog_pos;
+    iovcnt++;
+  }
+  iov[iovcnt].iov_base = backlog;
+  iov[iovcnt].iov_len = backlog_pos;
+  iovcnt++;
+  socket_client_outv(s, c, iov, iovcnt);
+}
+
+static const char *
+term_where(void)
+{
+  static char where[32];
+
+  if (s.path != NULL) {
+    return s.path;
+  }
+
+  snprintf(where, sizeof(where), "port %u", PORT);
+  return where;
+}
+
+static err_t
+term_load_script(const char *path)
+{
+  int fd;
+  int ret;
+  struct stat st;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    POSIX_ERROR(errno, "could not open console script '%s'", path);
+    return ERR_POSIX;
+  }
+
+  ret = fstat(fd, &st);
+  ON_POSIX_ERROR("script stat", ret, posix_err);
+
+  script = malloc(st.st_size);
+  if (script == NULL) {
+    close(fd);
+    return ERR_NO_MEM;
+  }
+
+  ret = read(fd, script, st.st_size);
+  ON_POSIX_ERROR("script read", ret, posix_err);
+  script_len = ret;
+  close(fd);
+  return ERR_NONE;
+ posix_err:
+  close(fd);
+  return ERR_POSIX;
+}
+
+static int
+term_hex(int c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+
+  return -1;
+}
+
+/*
+ * One event per line: the exit count, a space and the
+ * input bytes in hex. Lines starting with # are ignored.
+ */
+static err_t
+term_load_replay(const char *path)
+{
+  FILE *f;
+  char line[1024];
+  count_t max_events = 0;
+  length_t data_len = 0;
+  length_t data_max = 0;
+  unsigned lineno = 0;
+  err_t err = ERR_NONE;
+
+  f = fopen(path, "r");
+  if (f == NULL) {
+    POSIX_ERROR(errno, "could not open replay '%s'", path);
+    return ERR_POSIX;
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char *p;
+    uint64_t exits;
+    replay_event_t *e;
+
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+
+    exits = strtoull(line, &p, 10);
+    if (p == line || *p != ' ') {
+      ERROR(ERR_UNSUPPORTED, "%s:%u: bad event", path, lineno);
+      err = ERR_UNSUPPORTED;
+      goto done;
+    }
+
+    if (replay_count == max_events) {
+      max_events = max(max_events * 2, 64U);
+      e = realloc(replay, max_events * sizeof(*e));
+      if (e == NULL) {
+        err = ERR_NO_MEM;
+        goto done;
+      }
+      replay = e;
+    }
+
+    if (data_max - data_len < sizeof(line) / 2) {
+      char *d;
+
+      data_max = max(data_max * 2, (length_t) sizeof(line));
+      d = realloc(replay_data, data_max);
+      if (d == NULL) {
+        err = ERR_NO_MEM;
+        goto done;
+      }
+      replay_data = d;
+    }
+
+    e = replay + replay_count;
+    e->exits = exits;
+    e->off = data_len;
+    for (p++; term_hex(p[0]) >= 0 && term_hex(p[1]) >= 0; p += 2) {
+      replay_data[data_len++] = term_hex(p[0]) << 4 | term_hex(p[1]);
+    }
+    e->len = data_len - e->off;
+    if (e->len != 0) {
+      replay_count++;
+    }
+  }
+
+  LOG("replaying %u input events from '%s'", replay_count, path);
+ done:
+  fclose(f);
+  return err;
+}
+
+err_t
+term_record(const char *record_path,
+            const char *replay_path)
+{
+  err_t err;
+
+  if (replay_path != NULL) {
+    err = term_load_replay(replay_path);
+    if (err != ERR_NONE) {
+      return err;
+    }
+  }
+
+  if (record_path != NULL) {
+    record = fopen(record_path, "w");
+    if (record == NULL) {
+      POSIX_ERROR(errno, "could not open '%s' for recording", record_path);
+      return ERR_POSIX;
+    }
+    fprintf(record, "# PVP console input: exit count, bytes in hex\n");
+  }
+
+  return ERR_NONE;
+}
+
+bool
+term_recording(void)
+{
+  return record != NULL || replay_count != 0;
+}
+
+static void
+term_record_add(const char *buf,
+                length_t len)
+{
+  length_t i;
+
+  /*
+   * Keep lines short enough for term_load_replay.
+   */
+  for (i = 0; i < len; i++) {
+    if (i % 256 == 0) {
+      fprintf(record, "%s%llu ", i == 0 ? "" : "\n", guest->own_exits);
+    }
+    fprintf(record, "%02x", (uint8_t) buf[i]);
+  }
+  fputc('\n', record);
+}
+
+/*
+ * Replayed input that's due. While events are pending,
+ * nothing else is read, so typing doesn't upset timing.
+ */
+static length_t
+term_in_replay(char *buf,
+               length_t expected)
+{
+  replay_event_t *e = replay + replay_pos;
+  length_t len;
+
+  if (guest->own_exits < e->exits) {
+    return 0;
+  }
+
+  len = min(expected, e->len - replay_off);
+  memcpy(buf, replay_data + e->off + replay_off, len);
+  replay_off += len;
+  if (replay_off == e->len) {
+    replay_off = 0;
+    if (++replay_pos == replay_count) {
+      LOG("replay done at exit %llu", guest->own_exits);
+    }
+  }
+
+  return len;
 }
 
 static void
-term_on_disconnect(socket_t *s)
+term_on_disconnect(socket_t *s,
+                   socket_client_t *c)
 {
   const char *banner =
     "\r\n\nPVP console closing...\r\n";
 
-  socket_out(s, banner, strlen(banner));
+  socket_client_out(s, c, banner, strlen(banner));
 }
 
+/*
+ * Without headless, boot waits for a console client. Otherwise
+ * the guest starts right away, output is kept for replay (and
+ * appended to log_path, if given) and input is taken from
+ * script_path before anything typed by a client. The console
+ * listens on sock_path instead of TCP, if given. in_size is
+ * how much typed or pasted input can be queued (0 for the
+ * default) before the client is made to wait.
+ */
 err_t
-term_init(void)
+term_init(bool want_headless,
+          const char *log_path,
+          const char *script_path,
+          const char *sock_path,
+          length_t in_size)
 {
   err_t err;
 
+  headless = want_headless;
+  if (headless) {
+    backlog = malloc(BACKLOG_SIZE);
+    if (backlog == NULL) {
+      return ERR_NO_MEM;
+    }
+  }
+
+  if (log_path != NULL) {
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (log_fd < 0) {
+      POSIX_ERROR(errno, "could not open console log '%s'", log_path);
+      return ERR_POSIX;
+    }
+  }
+
+  if (script_path != NULL) {
+    err = term_load_script(script_path);
+    ON_ERROR("script", err, done);
+  }
+
   s.port = PORT;
+  s.path = sock_path;
+  s.max_clients = SOCKET_MAX_CLIENTS;
+  s.in_size = in_size;
+  s.telnet = sock_path == NULL;
   s.on_connect = term_on_connect;
   s.on_disconnect = term_on_disconnect;
   err = socket_init(&s);
   ON_ERROR("socket", err, done);
 
-  LOG("Waiting for console connection on %u", PORT);
-  while (socket_handle_connect(&s) != ERR_NONE);
+  if (headless) {
+    LOG("Console available on %s, not waiting", term_where());
+    goto done;
+  }
+
+  LOG("Waiting for console connection on %s", term_where());
+  socket_wait_connect(&s);
   LOG("Console connected");
 
  done:
@@ -46,19 +539,203 @@ term_init(void)
 void
 term_bye(void)
 {
-  socket_disconnect(&s);
+  term_flush();
+  socket_bye(&s);
+
+  if (log_fd != -1) {
+    close(log_fd);
+    log_fd = -1;
+  }
+  free(backlog);
+  backlog = NULL;
+  free(script);
+  script = NULL;
+  if (record != NULL) {
+    fclose(record);
+    record = NULL;
+  }
+  free(replay);
+  free(replay_data);
+  replay = NULL;
+  replay_data = NULL;
+  replay_count = replay_pos = 0;
 }
 
+/*
+ * Enter on a raw terminal is CR, but pasted text, scripts
+ * and line-mode clients send LF, CR LF or (telnet) CR NUL.
+ * All of those become a single CR. Returns the new length.
+ *
+ * Clients on the Unix socket get their bytes through as
+ * sent, and replays were cooked when recorded.
+ */
+static length_t
+term_in_cook(char *buf,
+             length_t len)
+{
+  length_t i;
+  length_t out = 0;
+
+  for (i = 0; i < len; i++) {
+    char c = buf[i];
+
+    if (in_cr && (c == '\n' || c == '\0')) {
+      in_cr = false;
+      continue;
+    }
+
+    in_cr = c == '\r';
+    if (c == '\n') {
+      c = '\r';
+    }
+    buf[out++] = c;
+  }
+
+  return out;
+}
+
+/*
+ * Hands over as much queued input as fits, so a paste
+ * goes through in as few reads as the guest allows.
+ */
 length_t
 term_in(char *buf,
         length_t expected)
 {
-  return socket_in(&s, buf, expected);
+  length_t got = 0;
+
+  while (got < expected) {
+    length_t len;
+    bool cook = true;
+
+    if (replay_pos < replay_count) {
+      len = term_in_replay(buf + got, expected - got);
+      if (len == 0) {
+        break;
+      }
+      cook = false;
+    } else if (script_pos < script_len) {
+      len = min(expected - got, script_len - script_pos);
+      memcpy(buf + got, script + script_pos, len);
+      script_pos += len;
+    } else {
+      len = socket_in(&s, buf + got, expected - got);
+      if (len == 0) {
+        break;
+      }
+      cook = s.telnet;
+    }
+
+    got += cook ? term_in_cook(buf + got, len) : len;
+  }
+
+  if (record != NULL && got != 0) {
+    term_record_add(buf, got);
+  }
+
+  in_bytes += got;
+  return got;
+}
+
+void
+term_io_counts(uint64_t *in,
+               uint64_t *out)
+{
+  *in = in_bytes;
+  *out = out_bytes;
+}
+
+void
+term_flush(void)
+{
+  int iovcnt = 1;
+  struct iovec iov[2];
+  length_t first = min(out_count, OUT_RING_SIZE - out_head);
+
+  if (out_count == 0) {
+    return;
+  }
+
+  iov[0].iov_base = out_ring + out_head;
+  iov[0].iov_len = first;
+  if (first != out_count) {
+    iov[1].iov_base = out_ring;
+    iov[1].iov_len = out_count - first;
+    iovcnt++;
+  }
+
+  /*
+   * Clients that connect now get caught up from the backlog,
+   * which mustn't have this chunk in it yet, or they'd see
+   * it twice.
+   */
+  socket_handle_connect(&s);
+
+  if (backlog != NULL) {
+    term_backlog_add(iov[0].iov_base, iov[0].iov_len);
+    if (iovcnt > 1) {
+      term_backlog_add(iov[1].iov_base, iov[1].iov_len);
+    }
+  }
+
+  conlog_add(iov[0].iov_base, iov[0].iov_len);
+  if (iovcnt > 1) {
+    conlog_add(iov[1].iov_base, iov[1].iov_len);
+  }
+
+  if (log_fd != -1 &&
+      writev(log_fd, iov, iovcnt) < 0) {
+    POSIX_ERROR(errno, "console log write");
+  }
+
+  socket_outv(&s, iov, iovcnt);
+  out_bytes += out_count;
+  out_head = 0;
+  out_count = 0;
 }
 
 void
 term_out(const char *buf,
          length_t len)
 {
-  socket_out(&s, buf, len);
+  while (len != 0) {
+    length_t tail;
+    length_t chunk;
+
+    if (out_count == OUT_RING_SIZE) {
+      term_flush();
+    }
+
+    tail = (out_head + out_count) % OUT_RING_SIZE;
+    chunk = min(len, OUT_RING_SIZE - out_count);
+    chunk = min(chunk, OUT_RING_SIZE - tail);
+    memcpy(out_ring + tail, buf, chunk);
+    out_count += chunk;
+    buf += chunk;
+    len -= chunk;
+  }
+}
+
+void
+term_out_xlat(const uint8_t *buf,
+              length_t len)
+{
+  length_t run;
+
+  while (len != 0) {
+    /*
+     * Queue everything up to the next character
+     * that needs translating in one go.
+     */
+    for (run = 0; run < len && out_xlat[buf[run]].len == 0; run++);
+    term_out((const char *) buf, run);
+    buf += run;
+    len -= run;
+
+    if (len != 0) {
+      term_out(out_xlat[*buf].s, out_xlat[*buf].len);
+      buf++;
+      len--;
+    }
+  }
 }
@@ -0,0 +1,485 @@
+/*
+ * 16550A UART, backed by the console socket.
+ *
+ * THR writes are queued in the term output ring and only
+ * flushed once a FIFO's worth has built up, or once the
+ * guest looks done transmitting: it polls LSR twice without
+ * writing in between, reads RBR, or exits for some other
+ * reason. LSR always reports THRE, so a polled TX loop
+ * never spins waiting on the host.
+ *
+ * While nothing has been received and reads have no side
+ * effects (no interrupts enabled, no loopback), the register
+ * page is mapped read-only from a shadow copy, so LSR polls
+ * don't exit at all and a TX loop costs one exit per THR
+ * write. A timer then stands in for the exits the polls used
+ * to cause, picking up input and flushing output.
+ *
+ * There's no interrupt controller, so IER and IIR are
+ * emulated for the benefit of probing only and the guest
+ * must poll.
+ */
+
+#define LOG_PFX UART
+#include "uart.h"
+#include "mmio.h"
+#include "term.h"
+#include "guest.h"
+#include "mon.h"
+
+#include <mach/mach_time.h>
+
+#define UART_SIZE  8
+#define FIFO_DEPTH 16
+#define TICK_US    10000
+
+#define REG_RBR 0 /* THR on write, DLL with DLAB */
+#define REG_IER 1 /* DLM with DLAB */
+#define REG_IIR 2 /* FCR on write */
+#define REG_LCR 3
+#define REG_MCR 4
+#define REG_LSR 5
+#define REG_MSR 6
+#define REG_SCR 7
+
+#define IER_RDI     0x01
+#define IER_THRI    0x02
+#define IIR_NO_INT  0x01
+#define IIR_THRI    0x02
+#define IIR_RDI     0x04
+#define IIR_FIFO    0xc0
+#define FCR_ENABLE  0x01
+#define FCR_CLR_RX  0x02
+#define FCR_CLR_TX  0x04
+#define LCR_DLAB    0x80
+#define MCR_DTR     0x01
+#define MCR_RTS     0x02
+#define MCR_OUT1    0x04
+#define MCR_OUT2    0x08
+#define MCR_LOOP    0x10
+#define LSR_DR      0x01
+#define LSR_THRE    0x20
+#define LSR_TEMT    0x40
+#define MSR_CTS     0x10
+#define MSR_DSR     0x20
+#define MSR_RI      0x40
+#define MSR_DCD     0x80
+
+typedef struct uart_s {
+  mmio_range_t mmio;
+  uint8_t ier;
+  uint8_t lcr;
+  uint8_t mcr;
+  uint8_t scr;
+  uint8_t dll;
+  uint8_t dlm;
+  bool fifo;
+  /*
+   * THRE interrupt condition, cleared by
+   * reading IIR or writing THR.
+   */
+  bool thri;
+  uint8_t rx[FIFO_DEPTH];
+  unsigned rx_head;
+  unsigned rx_count;
+  unsigned tx_count;
+  unsigned lsr_polls;
+  uint8_t *page;
+  bool shadowed;
+  uint64_t tick;
+  uint64_t deadline;
+  uint64_t tx_bytes;
+  uint64_t rx_bytes;
+  uint64_t flushes;
+} uart_t;
+
+static uart_t uart;
+
+static void
+uart_tx_flush(uart_t *u)
+{
+  if (u->tx_count == 0) {
+    return;
+  }
+
+  term_flush();
+  u->tx_count = 0;
+  u->flushes++;
+}
+
+static void
+uart_rx_put(uart_t *u,
+            uint8_t c)
+{
+  if (u->rx_count == FIFO_DEPTH) {
+    return;
+  }
+
+  u->rx[(u->rx_head + u->rx_count) % FIFO_DEPTH] = c;
+  u->rx_count++;
+}
+
+static void
+uart_rx_fill(uart_t *u)
+{
+  char buf[FIFO_DEPTH];
+  length_t want;
+  length_t got;
+  length_t i;
+
+  if (u->rx_count != 0 || (u->mcr & MCR_LOOP) != 0) {
+    return;
+  }
+
+  /*
+   * Without FIFOs, there's just the one holding register.
+   */
+  want = u->fifo ? FIFO_DEPTH : 1;
+  got = term_in(buf, want);
+  for (i = 0; i < got; i++) {
+    uart_rx_put(u, buf[i]);
+  }
+  u->rx_bytes += got;
+}
+
+static void
+uart_tx(uart_t *u,
+        uint8_t c)
+{
+  u->thri = true;
+  if ((u->mcr & MCR_LOOP) != 0) {
+    uart_rx_put(u, c);
+    return;
+  }
+
+  term_out((char *) &c, 1);
+  u->tx_bytes++;
+  if (++u->tx_count == FIFO_DEPTH) {
+    uart_tx_flush(u);
+  }
+}
+
+static uint8_t
+uart_msr(uart_t *u)
+{
+  uint8_t mcr = u->mcr;
+
+  if ((mcr & MCR_LOOP) == 0) {
+    return MSR_DCD | MSR_DSR | MSR_CTS;
+  }
+
+  return ((mcr & MCR_DTR) ? MSR_DSR : 0) |
+    ((mcr & MCR_RTS) ? MSR_CTS : 0) |
+    ((mcr & MCR_OUT1) ? MSR_RI : 0) |
+    ((mcr & MCR_OUT2) ? MSR_DCD : 0);
+}
+
+static uint8_t
+uart_iir(uart_t *u)
+{
+  uint8_t iir = u->fifo ? IIR_FIFO : 0;
+
+  if ((u->ier & IER_RDI) != 0 && u->rx_count != 0) {
+    return iir | IIR_RDI;
+  }
+
+  if ((u->ier & IER_THRI) != 0 && u->thri) {
+    u->thri = false;
+    return iir | IIR_THRI;
+  }
+
+  return iir | IIR_NO_INT;
+}
+
+/*
+ * Reads can be served from the shadow page.
+ */
+static bool
+uart_quiet(uart_t *u)
+{
+  return u->ier == 0 && (u->mcr & MCR_LOOP) == 0 &&
+    u->rx_count == 0 && !guest_is_little();
+}
+
+static void
+uart_shadow_update(uart_t *u)
+{
+  uint8_t *r = u->page + (u->mmio.base & PAGE_MASK);
+  bool dlab = (u->lcr & LCR_DLAB) != 0;
+
+  r[REG_RBR] = dlab ? u->dll : 0;
+  r[REG_IER] = dlab ? u->dlm : u->ier;
+  r[REG_IIR] = (u->fifo ? IIR_FIFO : 0) | IIR_NO_INT;
+  r[REG_LCR] = u->lcr;
+  r[REG_MCR] = u->mcr;
+  r[REG_LSR] = LSR_THRE | LSR_TEMT;
+  r[REG_MSR] = uart_msr(u);
+  r[REG_SCR] = u->scr;
+}
+
+static void
+uart_shadow_revoke(uart_t *u)
+{
+  if (!u->shadowed) {
+    return;
+  }
+
+  mmio_shadow_revoke(&u->mmio);
+  u->shadowed = false;
+  guest_set_timer(GUEST_TIMER_UART, 0);
+}
+
+static uint8_t *
+uart_shadow(mmio_range_t *m)
+{
+  uart_t *u = m->arg;
+
+  /*
+   * When and whether the page is mapped depends on host
+   * time, which would upset the exit count that input
+   * record and replay go by.
+   */
+  if (term_recording()) {
+    return NULL;
+  }
+
+  uart_rx_fill(u);
+  if (!uart_quiet(u)) {
+    return NULL;
+  }
+
+  /*
+   * (Re)armed for each mapping, as it may be going
+   * into the other context.
+   */
+  uart_shadow_update(u);
+  u->shadowed = true;
+  u->deadline = mach_absolute_time() + u->tick;
+  guest_set_timer(GUEST_TIMER_UART, u->deadline);
+  return u->page;
+}
+
+static err_t
+uart_read(mmio_range_t *m,
+          offset_t off,
+          length_t size,
+          uint32_t *val)
+{
+  uart_t *u = m->arg;
+  bool dlab = (u->lcr & LCR_DLAB) != 0;
+
+  if (off != REG_LSR) {
+    u->lsr_polls = 0;
+  }
+
+  switch (off) {
+  case REG_RBR:
+    if (dlab) {
+      *val = u->dll;
+      break;
+    }
+
+    /*
+     * Someone waiting on input wants to see
+     * what they've typed so far.
+     */
+    uart_tx_flush(u);
+    uart_rx_fill(u);
+    *val = 0;
+    if (u->rx_count != 0) {
+      *val = u->rx[u->rx_head];
+      u->rx_head = (u->rx_head + 1) % FIFO_DEPTH;
+      u->rx_count--;
+    }
+    break;
+  case REG_IER:
+    *val = dlab ? u->dlm : u->ier;
+    break;
+  case REG_IIR:
+    uart_rx_fill(u);
+    *val = uart_iir(u);
+    break;
+  case REG_LCR:
+    *val = u->lcr;
+    break;
+  case REG_MCR:
+    *val = u->mcr;
+    break;
+  case REG_LSR:
+    /*
+     * A polled TX loop reads LSR once per character. Two
+     * reads in a row mean the guest is waiting on something
+     * else, so make sure the output is visible.
+     */
+    if (++u->lsr_polls > 1) {
+      uart_tx_flush(u);
+    }
+    uart_rx_fill(u);
+    *val = LSR_THRE | LSR_TEMT;
+    if (u->rx_count != 0) {
+      *val |= LSR_DR;
+    }
+    break;
+  case REG_MSR:
+    *val = uart_msr(u);
+    break;
+  case REG_SCR:
+    *val = u->scr;
+    break;
+  default:
+    return ERR_OUT_OF_BOUNDS;
+  }
+
+  return ERR_NONE;
+}
+
+static err_t
+uart_write(mmio_range_t *m,
+           offset_t off,
+           length_t size,
+           uint32_t val)
+{
+  uart_t *u = m->arg;
+  bool dlab = (u->lcr & LCR_DLAB) != 0;
+
+  u->lsr_polls = 0;
+  switch (off) {
+  case REG_RBR:
+    if (dlab) {
+      u->dll = val;
+    } else {
+      uart_tx(u, val);
+    }
+    break;
+  case REG_IER:
+    if (dlab) {
+      u->dlm = val;
+    } else {
+      u->ier = val & 0x0f;
+    }
+    break;
+  case REG_IIR:
+    u->fifo = (val & FCR_ENABLE) != 0;
+    if ((val & FCR_CLR_RX) != 0) {
+      u->rx_count = 0;
+    }
+    if ((val & FCR_CLR_TX) != 0) {
+      /*
+       * Too late to take it back from the host.
+       */
+      uart_tx_flush(u);
+    }
+    break;
+  case REG_LCR:
+    u->lcr = val;
+    break;
+  case REG_MCR:
+    u->mcr = val & 0x1f;
+    break;
+  case REG_LSR:
+  case REG_MSR:
+    break;
+  case REG_SCR:
+    u->scr = val;
+    break;
+  default:
+    return ERR_OUT_OF_BOUNDS;
+  }
+
+  if (u->shadowed) {
+    if (uart_quiet(u)) {
+      uart_shadow_update(u);
+    } else {
+      uart_shadow_revoke(u);
+    }
+  }
+
+  return ERR_NONE;
+}
+
+static void
+uart_sync(mmio_range_t *m)
+{
+  uint64_t now;
+  uart_t *u = m->arg;
+
+  u->lsr_polls = 0;
+  uart_tx_flush(u);
+
+  if (!u->shadowed) {
+    return;
+  }
+
+  now = mach_absolute_time();
+  if (now < u->deadline) {
+    return;
+  }
+
+  /*
+   * The guest may be polling LSR for input
+   * without exiting.
+   */
+  uart_rx_fill(u);
+  if (!uart_quiet(u)) {
+    uart_shadow_revoke(u);
+    return;
+  }
+
+  u->deadline = now + u->tick;
+  guest_set_timer(GUEST_TIMER_UART, u->deadline);
+}
+
+err_t
+uart_init(gra_t base)
+{
+  kern_return_t kr;
+  vm_address_t page;
+  mach_timebase_info_data_t tb;
+  uart_t *u = &uart;
+
+  kr = vm_allocate(mach_task_self(), &page, PAGE_SIZE, VM_FLAGS_ANYWHERE);
+  ON_MACH_ERROR("uart_init vm_allocate", kr, err);
+
+  /*
+   * Anything else in the page floats, like mmio_read.
+   */
+  u->page = (uint8_t *) page;
+  memset(u->page, 0xff, PAGE_SIZE);
+  mach_timebase_info(&tb);
+  u->tick = (uint64_t) TICK_US * 1000 * tb.denom / tb.numer;
+
+  u->mmio.name = "uart";
+  u->mmio.base = base;
+  u->mmio.size = UART_SIZE;
+  u->mmio.read = uart_read;
+  u->mmio.write = uart_write;
+  u->mmio.sync = uart_sync;
+  u->mmio.shadow = uart_shadow;
+  u->mmio.arg = u;
+  u->thri = true;
+  mmio_add(&u->mmio);
+  return ERR_NONE;
+
+ err:
+  return ERR_MACH;
+}
+
+void
+uart_mon_dump(void)
+{
+  uart_t *u = &uart;
+
+  if (u->mmio.size == 0) {
+    mon_printf("no UART\n");
+    return;
+  }
+
+  mon_printf("UART at 0x%08x:\n", u->mmio.base);
+  mon_printf("  IER 0x%02x LCR 0x%02x MCR 0x%02x FIFO %s\n",
+             u->ier, u->lcr, u->mcr, u->fifo ? "on" : "off");
+  mon_printf("  TX %llu bytes in %llu flushes, %u pending\n",
+             u->tx_bytes, u->flushes, u->tx_count);
+  mon_printf("  RX %llu bytes, %u queued\n", u->rx_bytes, u->rx_count);
+  mon_printf("  registers %s\n", u->shadowed ?
+             "mapped read-only" : "trapped");
+}